@@ -36,24 +36,49 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <langinfo.h>
+#include <limits.h>
 #include <locale.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <wchar.h>
 #include <wctype.h>
 
 #if defined(__GLIBC__)
+#define getchar getchar_unlocked
+#define putchar putchar_unlocked
 #define getwchar getwchar_unlocked
 #define putwchar putwchar_unlocked
 #define fputws fputws_unlocked
+#define fwrite fwrite_unlocked
 #endif
 
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+
+#define CACHE_HEAD 21
+
+#define CLUSTER_MIN 0x300
+#define CLUSTER_MAX 16
+#define CLUSTER_CACHE 64
+#define ZWJ 0x200d
+#define IS_RI(c) ((c) >= 0x1f1e6 && (c) <= 0x1f1ff)
 
 struct seq {
 	int backward;
@@ -70,27 +95,63 @@ struct item {
 struct col {
 	int right_aligned;
 	size_t width;
+	size_t rest;
 };
 
 struct row {
 	size_t last;
 };
 
+struct cluster {
+	wchar_t text[CLUSTER_MAX];
+	size_t len;
+	int width;
+};
+
+static int bytes;
 static wchar_t delim;
+static wchar_t line_end;
+static const wchar_t *delim_str;
+static size_t delim_len;
 static int words;
 static int sentences;
 static int nuls;
 static int colors;
 static int cols_fixed;
 static int table;
+static int csv;
+static int intern;
 static size_t tail;
 
 static size_t term_width = 80;
+static size_t widths[16];
+static size_t widths_len;
 static size_t padding;
+static size_t tab_size;
 static int across;
 static int info;
+static int batch;
+static int grow;
+static int pipelined;
+static int mapped;
+static int records;
+static size_t page_size;
+static int layout;
+static int approximate;
+static size_t first_row;
+static size_t row_count = SIZE_MAX;
+static int order;
+static int unique;
 static struct seq right[16];
 static size_t right_len;
+static size_t field_list[16];
+static size_t field_list_len;
+static size_t field_max;
+static const char *sock_path;
+static const char *cache_dir;
+static const char *loaded_ctype;
+static int arg_count;
+static char **args;
 
 static wchar_t *buf;
 static size_t buf_len;
@@ -99,28 +160,84 @@ static size_t buf_alloc = 512;
 static struct item *list;
 static size_t list_len;
 static size_t list_alloc = 32;
+static size_t *seen;
+static size_t seen_alloc;
+static struct item *values;
+static size_t values_len;
+static size_t values_alloc;
+static uint32_t *ids;
+static size_t ids_alloc;
+
+static size_t next_list;
+static size_t (*parse_item)(size_t, struct item *);
+static size_t csv_next;
+static size_t csv_block;
+static uint64_t csv_ends;
+static uint64_t csv_quoted;
+static uint64_t csv_open;
+static struct item picked[16];
+static size_t picked_len;
+
+static const char *map;
+static size_t map_len;
+
+static char *cache_path;
+static char *cache_temp;
+static unsigned char cache_head[CACHE_HEAD];
+static int cache_out = -1;
+static size_t *offs;
+static size_t offs_alloc;
 
 static size_t num_rows;
 static size_t num_cols;
 static struct col *cols;
+static size_t cols_alloc;
 static struct row *rows;
 static size_t rows_alloc = 8;
 static size_t surplus;
+static size_t row_slack;
+static size_t min_rows;
+static size_t max_across = SIZE_MAX;
 static size_t *wider;
+static size_t wider_alloc;
+static size_t *pending;
+static size_t pending_len;
+static size_t lut_len;
+static size_t *prev_widths;
 static int status;
 
+static int measuring;
+static int gather;
+static int splice_out;
+static struct iovec iov[1024];
+static size_t iov_len;
+static size_t iov_bytes;
+static char stage[65536];
+static size_t stage_len;
+static size_t out_off;
+static size_t out_col;
+static size_t *item_offs;
+static struct cluster clusters[CLUSTER_CACHE];
+
 static void die(const char *);
 static void *xmalloc(size_t);
 static void *xrealloc(void *, size_t);
 static int xwcwidth(wchar_t);
+static int write_full(int, const void *, size_t);
 
 static void
 usage_error(void) {
 	fputs("Usage:\
-\tnat [-d delimiter|-s|-S] [-R] [-w width|-c columns] [-p padding] [-a]\n\
-\t    [-r column[,column]...] [-I]\n\
-\tnat -t [-d delimiter|-s|-S] [-R] [-c columns] [-p padding]\n\
-\t    [-r column[,column]...] [-I]\n", stderr);
+\tnat [-d delimiter|-s|-S] [-R] [-w width[,width]...|-c columns]\n\
+\t    [-p padding] [-a|-A] [-e]\n\
+\t    [-r column[,column]...] [-o order] [-u] [-b|-g|-i|-m|-P items]\n\
+\t    [-l row[:count]] [-I|-j] [-k directory]\n\
+\tnat -t|-q [-d delimiter|-s|-S] [-R] [-c columns|-f field[,field]...]\n\
+\t    [-p padding] [-r column[,column]...] [-b|-i|-P rows]\n\
+\t    [-l row[:count]] [-e] [-U] [-I|-j] [-k directory]\n\
+\tnat -M [-w width[,width]...|-c columns] [-p padding] [-a|-A] [-e]\n\
+\t    [-r column[,column]...] [-l row[:count]] [-I|-j]\n\
+\tnat -D socket\n", stderr);
 	exit(2);
 }
 
@@ -199,28 +316,61 @@ set_defaults(void) {
 		to_size(env, &term_width);
 
 	delim = L'\n';
+	delim_str = L"\n";
+	delim_len = 1;
 	padding = 2;
 }
 
+/* Widths are kept in descending order, and term_width is set to the first,
+ * which is what the list is parsed with. */
 static int
-parse_width(const char *s) {
-	size_t x;
+parse_width(const char *p) {
+	size_t base, x;
+	size_t i;
+	char *end;
+
+	base = term_width;
+	widths_len = 0;
+
+	for (;;) {
+		if (widths_len >= sizeof widths/sizeof widths[0]) {
+			errno = ENOMEM;
+			return 0;
+		}
+
+		if (*p == '-') {
+			if (!parse_size(&p[1], &end, &x)) {
+				return 0;
+			}
+			else if (x > base) {
+				errno = EINVAL;
+				return 0;
+			}
 
-	if (*s == '-') {
-		if (!to_size(&s[1], &x)) {
+			x = base-x;
+		}
+		else if (!parse_size(p, &end, &x)) {
 			return 0;
 		}
-		else if (x > term_width) {
+
+		for (i = widths_len++; i > 0 && widths[i-1] < x; i--)
+			widths[i] = widths[i-1];
+
+		widths[i] = x;
+
+		if (*end == '\0') {
+			break;
+		}
+		else if (*end != ',') {
 			errno = EINVAL;
 			return 0;
 		}
 
-		term_width -= x;
-	}
-	else if (!to_size(s, &term_width)) {
-		return 0;
+		p = end+1;
 	}
 
+	term_width = widths[0];
+
 	return 1;
 }
 
@@ -260,6 +410,106 @@ parse_seq(const char *p, char **endp, struct seq *dst) {
 	return 1;
 }
 
+static int
+parse_window(const char *p) {
+	char *end;
+
+	if (!parse_size(p, &end, &first_row)) {
+		return 0;
+	}
+	else if (first_row == 0) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	first_row--;
+
+	if (*end == ':') {
+		p = end+1;
+		if (!parse_size(p, &end, &row_count))
+			return 0;
+	}
+	else {
+		row_count = SIZE_MAX;
+	}
+
+	if (*end != '\0') {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* An empty delimiter stands for NUL. */
+static int
+parse_delim(const char *p) {
+	wchar_t *s;
+	size_t n, i;
+
+	n = bytes ? strlen(p) : mbstowcs(NULL, p, 0);
+	if (n == (size_t)-1)
+		return 0;
+
+	s = xmalloc((n+1)*sizeof s[0]);
+
+	if (bytes) {
+		for (i = 0; i <= n; i++)
+			s[i] = (unsigned char)p[i];
+	}
+	else {
+		mbstowcs(s, p, n+1);
+	}
+
+	delim = s[0];
+	delim_str = s;
+	delim_len = n > 0 ? n : 1;
+
+	return 1;
+}
+
+/* Tells if the delimiter can be part of a color sequence, in which case the
+ * sequences have to be recognized to find delimiters. */
+static int
+colors_hide_delim(void) {
+	return colors && wcspbrk(delim_str, L"\33[0123456789;m") != NULL;
+}
+
+static int
+parse_fields(const char *p) {
+	char *end;
+	size_t x;
+
+	for (;;) {
+		if (field_list_len >= sizeof field_list/sizeof field_list[0]) {
+			errno = ENOMEM;
+			return 0;
+		}
+
+		if (!parse_size(p, &end, &x)) {
+			return 0;
+		}
+		else if (x == 0) {
+			errno = EINVAL;
+			return 0;
+		}
+
+		field_list[field_list_len++] = x;
+		if (x > field_max)
+			field_max = x;
+
+		if (*end == '\0') {
+			return 1;
+		}
+		else if (*end != ',') {
+			errno = EINVAL;
+			return 0;
+		}
+
+		p = end+1;
+	}
+}
+
 static int
 parse_right(const char *p) {
 	char *end;
@@ -289,16 +539,18 @@ parse_right(const char *p) {
 
 static void
 parse_args(int argc, char *argv[]) {
-	int opt;
+	const char *env;
+	int opt, n;
 	size_t x;
 
-	while ((opt = getopt(argc, argv, ":d:sSRw:c:p:axn:r:tI")) != -1)
+	for (n = 0;
+	    (opt = getopt(argc, argv, ":d:sSRw:c:p:aexAn:r:o:ubgimMP:l:tqf:UIjk:D:")) != -1; n++)
 		switch (opt) {
 		case 'd':
-			if (mbtowc(&delim, optarg, strlen(optarg)+1) == -1) {
+			if (!parse_delim(optarg))
 				die("-d");
-			}
-			else if (table && delim == L'\n') {
+
+			if (table && wmemchr(delim_str, L'\n', delim_len)) {
 				errno = EINVAL;
 				die("-d");
 			}
@@ -347,6 +599,20 @@ parse_args(int argc, char *argv[]) {
 			if (!to_size(optarg, &padding))
 				die(optarg);
 
+			break;
+		case 'e':
+			tab_size = 8;
+
+			if ((env = getenv("TABSIZE")) && *env) {
+				if (!to_size(env, &tab_size)) {
+					die("TABSIZE");
+				}
+				else if (tab_size == 0) {
+					errno = EINVAL;
+					die("TABSIZE");
+				}
+			}
+
 			break;
 		case 'x':
 		case 'a':
@@ -355,15 +621,64 @@ parse_args(int argc, char *argv[]) {
 
 			across = 1;
 			break;
+		case 'A':
+			approximate = 1;
+			break;
 		case 'n':
 		case 'r':
 			if (!parse_right(optarg))
 				die(optarg);
 
 			break;
+		case 'o':
+			if (strlen(optarg) != 1 || !strchr("bcn", *optarg)) {
+				errno = EINVAL;
+				die("-o");
+			}
+
+			order = *optarg;
+			break;
+		case 'u':
+			unique = 1;
+			break;
+		case 'b':
+			batch = 1;
+			break;
+		case 'g':
+			grow = 1;
+			break;
+		case 'i':
+			pipelined = 1;
+			break;
+		case 'm':
+			mapped = 1;
+			break;
+		case 'M':
+			records = 1;
+			break;
+		case 'P':
+			if (!to_size(optarg, &page_size)) {
+				die(optarg);
+			}
+			else if (page_size == 0) {
+				errno = EINVAL;
+				die("-P");
+			}
+
+			break;
+		case 'l':
+			if (!parse_window(optarg))
+				die(optarg);
+
+			break;
+		case 'q':
+			csv = 1;
+			/* FALLTHROUGH */
 		case 't':
-			if (!words && delim == L'\n')
-				delim = L'\t';
+			if (!words && delim_len == 1 && delim == L'\n') {
+				delim = csv ? L',' : L'\t';
+				delim_str = csv ? L"," : L"\t";
+			}
 
 			if (cols_fixed && num_cols != 0) {
 				tail = num_cols;
@@ -377,31 +692,128 @@ parse_args(int argc, char *argv[]) {
 			table = 1;
 			cols_fixed = 1;
 			break;
+		case 'f':
+			if (!parse_fields(optarg))
+				die(optarg);
+
+			break;
+		case 'U':
+			intern = 1;
+			break;
 		case 'I':
 			info = 1;
+			layout = 0;
+			break;
+		case 'j':
+			layout = 1;
+			info = 0;
+			break;
+		case 'k':
+			cache_dir = optarg;
+			break;
+		case 'D':
+			sock_path = optarg;
 			break;
 		default:
 			usage_error();
 		}
 
-	if (optind != argc)
+	arg_count = argc;
+	args = argv;
+
+	if (optind != argc || (sock_path && n > 1))
+		usage_error();
+
+	if (table && (order || unique))
+		usage_error();
+
+	if (unique && widths_len > 1)
+		usage_error();
+
+	if (approximate && (table || across || cols_fixed))
+		usage_error();
+
+	if (field_list_len && (!table || tail != SIZE_MAX))
+		usage_error();
+
+	if (intern && !table)
+		usage_error();
+
+	if (csv && (words || delim_len > 1 || delim == L'"' || tail != SIZE_MAX))
+		usage_error();
+
+	if (mapped && (table || words || colors || order || unique || batch))
+		usage_error();
+
+	if (page_size && (batch || mapped))
+		usage_error();
+
+	if (records && (table || words || colors || order || unique || batch
+			|| grow || mapped || page_size || cache_dir
+			|| delim_len != 1 || delim != L'\n'))
+		usage_error();
+
+	if (cache_dir && (page_size || mapped))
+		usage_error();
+
+	if (pipelined && (batch || grow || mapped || page_size || records
+			|| cache_dir))
+		usage_error();
+
+	if ((page_size || grow || pipelined) && colors_hide_delim())
+		usage_error();
+
+	if (grow && (table || words || order || batch || mapped || page_size
+			|| cache_dir || info || layout || widths_len > 1
+			|| first_row != 0 || row_count != SIZE_MAX))
 		usage_error();
 }
 
-static void
-slurp_input(void) {
-	wint_t c;
+static wint_t
+read_char(void) {
+	int c;
 
-	buf = xmalloc(buf_alloc*sizeof buf[0]);
+	if (!bytes)
+		return getwchar();
+
+	c = getchar();
+	if (c == EOF)
+		return WEOF;
+
+	return (unsigned char)c;
+}
 
-	while ((c = getwchar()) != WEOF) {
+static void
+slurp_bytes(void) {
+	int c;
+
+	while ((c = getchar()) != EOF) {
 		if (buf_len >= buf_alloc) {
 			buf_alloc *= 2;
 			buf = xrealloc(buf, buf_alloc*sizeof buf[0]);
 		}
 
-		buf[buf_len++] = c;
+		buf[buf_len++] = (unsigned char)c;
 	}
+}
+
+static void
+slurp_input(void) {
+	wint_t c;
+
+	buf = xmalloc(buf_alloc*sizeof buf[0]);
+
+	if (bytes)
+		slurp_bytes();
+	else
+		while ((c = getwchar()) != WEOF) {
+			if (buf_len >= buf_alloc) {
+				buf_alloc *= 2;
+				buf = xrealloc(buf, buf_alloc*sizeof buf[0]);
+			}
+
+			buf[buf_len++] = c;
+		}
 
 	if (ferror(stdin))
 		die("stdin");
@@ -412,43 +824,48 @@ slurp_input(void) {
 
 static void
 fix_eof(void) {
-	wchar_t found, expected;
-
-	found = buf[buf_len-1];
+	const wchar_t *expected;
+	size_t n;
 
 	if (table) {
-		expected = L'\n';
+		expected = L"\n";
+		n = 1;
 	}
 	else if (words) {
 		return;
 	}
-	else if (delim != L'\n' && found == L'\n') {
-		buf[buf_len-1] = delim;
-		return;
-	}
 	else {
-		expected = delim;
+		expected = delim_str;
+		n = delim_len;
 	}
 
-	if (found != expected) {
-		if (buf_len >= buf_alloc) {
-			buf_alloc++;
-			buf = xrealloc(buf, buf_alloc*sizeof buf[0]);
-		}
+	if (buf_len >= n && !wmemcmp(&buf[buf_len-n], expected, n))
+		return;
 
-		buf[buf_len++] = expected;
+	/* A final newline ends the last item. */
+	if (buf[buf_len-1] == L'\n')
+		buf_len--;
+
+	if (buf_len+n > buf_alloc) {
+		buf_alloc = buf_len+n;
+		buf = xrealloc(buf, buf_alloc*sizeof buf[0]);
 	}
+
+	wmemcpy(&buf[buf_len], expected, n);
+	buf_len += n;
 }
 
 static void
 init_parse(void) {
-	if ((words || delim != L'\0') && wmemchr(buf, L'\0', buf_len))
-		nuls = 1;
+	nuls = (words || delim_len > 1 || delim != L'\0') && wmemchr(buf, L'\0', buf_len);
 
 	fix_eof();
-	list = xmalloc(list_alloc*sizeof list[0]);
+	next_list = 0;
 
-	if (table)
+	if (list == NULL)
+		list = xmalloc(list_alloc*sizeof list[0]);
+
+	if (table && rows == NULL)
 		rows = xmalloc(rows_alloc*sizeof rows[0]);
 }
 
@@ -478,6 +895,11 @@ skip_color(size_t i) {
 	return j;
 }
 
+static int
+match_delim(size_t i) {
+	return buf_len-i >= delim_len && !wmemcmp(&buf[i], delim_str, delim_len);
+}
+
 static int
 is_delim(size_t i) {
 	if (words) {
@@ -489,17 +911,121 @@ is_delim(size_t i) {
 			return 1;
 		}
 	}
-	else if (buf[i] == delim || (table && buf[i] == L'\n')) {
+	else if (buf[i] == delim && (delim_len == 1 || match_delim(i))) {
+		return 1;
+	}
+	else if (table && buf[i] == L'\n') {
 		return 1;
 	}
 
 	return 0;
 }
 
+/* Tells if c is a format character or a separator. Those have no width, but
+ * unlike combining marks, do not join the character before them. */
+static int
+is_format(wchar_t c) {
+	static const wchar_t ranges[][2] = {
+		{0x600, 0x605}, {0x61c, 0x61c}, {0x6dd, 0x6dd}, {0x70f, 0x70f},
+		{0x180e, 0x180e}, {0x200b, 0x200b}, {0x200e, 0x200f},
+		{0x2028, 0x202e}, {0x2060, 0x206f}, {0xfeff, 0xfeff},
+		{0xfff9, 0xfffb}, {0x110bd, 0x110bd}, {0x1bca0, 0x1bca3},
+		{0x1d173, 0x1d17a}, {0xe0001, 0xe0001}
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof ranges/sizeof ranges[0]; i++)
+		if (c >= ranges[i][0] && c <= ranges[i][1])
+			return 1;
+
+	return 0;
+}
+
+/* Tells if p[n] continues the grapheme cluster p[0], ..., p[n-1]. A cluster is
+ * a character followed by combining marks, variation selectors, emoji
+ * modifiers, and joiners each followed by an emoji; or a pair of regional
+ * indicators, which terminals draw as a flag. Zero width spaces, other format
+ * characters, and whitespace are not part of clusters. */
+static int
+extends(const wchar_t *p, size_t n) {
+	wchar_t c;
+
+	c = p[n];
+	if (c < CLUSTER_MIN)
+		return 0;
+	else if (p[n-1] == ZWJ)
+		return (c >= 0x2600 && c <= 0x27bf) || (c >= 0x1f000 && c <= 0x1faff);
+	else if (IS_RI(c))
+		return n == 1 && IS_RI(p[0]);
+	else if (c == ZWJ || (c >= 0x1f3fb && c <= 0x1f3ff))
+		return 1;
+
+	return wcwidth(c) == 0 && !iswspace(c) && !is_format(c);
+}
+
+/* A cluster is as wide as its first character, except that flags and ones
+ * asking for emoji presentation take two columns. */
+static int
+cluster_width(const wchar_t *p, size_t n) {
+	size_t i;
+
+	if (IS_RI(p[0]))
+		return n == 2 ? 2 : 1;
+
+	for (i = 1; i < n; i++)
+		if (p[i] == 0xfe0f)
+			return 2;
+
+	return xwcwidth(p[0]);
+}
+
+/* Returns the length of the grapheme cluster at buf[i], which can be at most n
+ * long, and stores its width in *x. Clusters of more than one character are
+ * cached so that those repeated in the input are not segmented again. */
+static size_t
+measure_cluster(size_t i, size_t n, int *x) {
+	struct cluster *p;
+	size_t len;
+
+	if (n < 2 || buf[i+1] < CLUSTER_MIN) {
+		*x = xwcwidth(buf[i]);
+		return 1;
+	}
+
+	p = &clusters[(buf[i]*31u + buf[i+1]) % CLUSTER_CACHE];
+	len = p->len;
+
+	if (len > 1 && len <= n && !wmemcmp(p->text, &buf[i], len)
+			&& (len == n || !extends(&buf[i], len))) {
+		*x = p->width;
+		return len;
+	}
+
+	for (len = 1; len < n && len < CLUSTER_MAX; len++)
+		if (!extends(&buf[i], len))
+			break;
+
+	if (len == 1) {
+		*x = xwcwidth(buf[i]);
+		return 1;
+	}
+
+	*x = cluster_width(&buf[i], len);
+
+	if (len < CLUSTER_MAX) {
+		wmemcpy(p->text, &buf[i], len);
+		p->len = len;
+		p->width = *x;
+	}
+
+	return len;
+}
+
 static size_t
 parse_tail(size_t begin, struct item *dst) {
-	size_t i, j;
+	size_t i, j, n;
 	size_t len, width;
+	int x;
 
 	len = 0;
 	width = 0;
@@ -517,8 +1043,10 @@ parse_tail(size_t begin, struct item *dst) {
 		if (buf[i] == L'\n')
 			break;
 
-		len++;
-		width += xwcwidth(buf[i]);
+		n = measure_cluster(i, buf_len-i, &x);
+		len += n;
+		width += x;
+		i += n-1;
 	}
 
 	dst->text = &buf[begin];
@@ -528,50 +1056,317 @@ parse_tail(size_t begin, struct item *dst) {
 	return i;
 }
 
+/* Finds the next delimiter from i on, for skip_item(); items being measured are
+ * scanned a character at a time anyway. Candidates are found by their first
+ * character and ruled out by their last before being compared in full. */
 static size_t
-parse_item(size_t begin, struct item *dst) {
-	size_t len, width;
-	int truncated;
-	size_t i, j;
-	int x;
+find_delim(size_t i) {
+	const wchar_t *p, *end;
+	size_t n;
 
-	len = 0;
-	width = 0;
-	truncated = 0;
+	end = &buf[buf_len];
+	n = delim_len;
 
-	for (i = begin; i < buf_len; i++) {
-		if (colors && (j = skip_color(i)) != i) {
-			if (!truncated)
-				len += j-i + 1;
+	for (p = &buf[i]; (p = wmemchr(p, delim, end-p)); p++)
+		if (n == 1 || ((size_t)(end-p) >= n && p[n-1] == delim_str[n-1]
+				&& !wmemcmp(p+1, delim_str+1, n-2)))
+			return p-buf;
 
-			i = j;
-			continue;
-		}
+	return buf_len;
+}
 
-		if (is_delim(i))
-			break;
+/* Finds the end of an item truncated at i. What follows the cut is not
+ * printed, so color sequences there need not be recognized unless they can
+ * hide a delimiter. */
+static size_t
+skip_item(size_t i) {
+	size_t j;
+
+	if (colors_hide_delim()) {
+		for (; i < buf_len; i++) {
+			if ((j = skip_color(i)) != i)
+				i = j;
+			else if (is_delim(i))
+				break;
+		}
+
+		return i;
+	}
+
+	if (words || table) {
+		while (i < buf_len && !is_delim(i))
+			i++;
+
+		return i;
+	}
+
+	return find_delim(i);
+}
+
+/* Finds the end of the cell at i without measuring it. */
+static size_t
+cell_end(size_t i) {
+	if (colors || words || delim_len > 1)
+		return skip_item(i);
+
+	while (i < buf_len && buf[i] != delim && buf[i] != L'\n')
+		i++;
+
+	return i;
+}
+
+/* Item parsing loops are generated for each way items can end, with and
+ * without color sequences to skip, so that no option is tested for each
+ * character; select_parser() picks one before parsing. */
+#define ENDS_LINE(i) (buf[i] == delim || buf[i] == line_end)
+#define ENDS_STRING(i) (buf[i] == delim ? match_delim(i) : buf[i] == line_end)
+#define ENDS_WORD(i) iswspace(buf[i])
+#define ENDS_SENTENCE(i) (buf[i] == L' ' \
+	? (i) >= buf_len-1 || iswspace(buf[(i)+1]) : iswspace(buf[i]))
+
+#define DEFINE_PARSE_ITEM(name, skips_colors, ends) \
+static size_t \
+name(size_t begin, struct item *dst) { \
+	size_t len, width, limit; \
+	size_t i, j, k, n; \
+	int x; \
+\
+	len = 0; \
+	width = 0; \
+	limit = cols_fixed ? SIZE_MAX : term_width; \
+\
+	for (i = begin; i < buf_len; i++) { \
+		if (skips_colors && (j = skip_color(i)) != i) { \
+			len += j-i + 1; \
+			i = j; \
+			continue; \
+		} \
+\
+		if (ends(i)) \
+			break; \
+\
+		if (i+1 < buf_len && buf[i+1] >= CLUSTER_MIN) { \
+			n = measure_cluster(i, buf_len-i, &x); \
+			for (k = 1; k < n; k++) \
+				if (ends(i+k)) { \
+					n = k; \
+					x = cluster_width(&buf[i], n); \
+					break; \
+				} \
+		} \
+		else { \
+			n = 1; \
+			x = xwcwidth(buf[i]); \
+		} \
+\
+		if (width+x > limit) { \
+			i = skip_item(i); \
+			status = 1; \
+			break; \
+		} \
+\
+		len += n; \
+		width += x; \
+		i += n-1; \
+	} \
+\
+	dst->text = &buf[begin]; \
+	dst->len = len; \
+	dst->width = width; \
+\
+	return i; \
+}
+
+DEFINE_PARSE_ITEM(parse_line, 0, ENDS_LINE)
+DEFINE_PARSE_ITEM(parse_line_colored, 1, ENDS_LINE)
+DEFINE_PARSE_ITEM(parse_string, 0, ENDS_STRING)
+DEFINE_PARSE_ITEM(parse_string_colored, 1, ENDS_STRING)
+DEFINE_PARSE_ITEM(parse_word, 0, ENDS_WORD)
+DEFINE_PARSE_ITEM(parse_word_colored, 1, ENDS_WORD)
+DEFINE_PARSE_ITEM(parse_sentence, 0, ENDS_SENTENCE)
+DEFINE_PARSE_ITEM(parse_sentence_colored, 1, ENDS_SENTENCE)
+
+static void
+select_parser(void) {
+	line_end = table ? L'\n' : delim;
+
+	if (words && sentences)
+		parse_item = colors ? parse_sentence_colored : parse_sentence;
+	else if (words)
+		parse_item = colors ? parse_word_colored : parse_word;
+	else if (delim_len > 1)
+		parse_item = colors ? parse_string_colored : parse_string;
+	else
+		parse_item = colors ? parse_line_colored : parse_line;
+}
+
+/* The state of CSV input between two characters: inside quotes, or where a
+ * quote would open them, which is at the start of a field and right after a
+ * closing quote, where it is the second of an escaped pair. Anywhere else, a
+ * quote is an ordinary character. */
+#define CSV_QUOTED 1
+#define CSV_OPEN 2
+
+static int
+csv_state(int st, wchar_t c) {
+	if (c == L'"' && st != 0)
+		return st == CSV_QUOTED ? CSV_OPEN : CSV_QUOTED;
+	else if (st == CSV_QUOTED)
+		return CSV_QUOTED;
+
+	return c == delim || c == L'\n' ? CSV_OPEN : 0;
+}
+
+static int
+trailing_zeros(uint64_t x) {
+#if defined(__GNUC__)
+	return __builtin_ctzll(x);
+#else
+	int n;
+
+	for (n = 0; !(x & 1); x >>= 1)
+		n++;
+
+	return n;
+#endif
+}
+
+/* Finds the field ends among the 64 characters from csv_block on. Those are
+ * delimiters and newlines outside quotes; a character is inside quotes if an
+ * odd number of quotes precede it, which the prefix XOR of the quote
+ * positions tells for the whole block at once. Escaped quotes toggle the
+ * state twice and need no special care. That only holds if every quote
+ * toggles it, though; if one that would open quotes comes where a quote is an
+ * ordinary character, the block is scanned again a character at a time. */
+static void
+scan_block(void) {
+	uint64_t quotes, ends, quoted, open;
+	size_t i, n;
+	wchar_t c;
+	int st;
+
+	n = MIN(64, buf_len-csv_block);
+	quotes = 0;
+	ends = 0;
+
+	for (i = 0; i < n; i++) {
+		c = buf[csv_block+i];
+		quotes |= (uint64_t)(c == L'"') << i;
+		ends |= (uint64_t)(c == delim || c == L'\n') << i;
+	}
+
+	quoted = quotes;
+	quoted ^= quoted << 1;
+	quoted ^= quoted << 2;
+	quoted ^= quoted << 4;
+	quoted ^= quoted << 8;
+	quoted ^= quoted << 16;
+	quoted ^= quoted << 32;
+	quoted ^= csv_quoted;
+
+	open = (ends | quotes) & ~quoted;
+	if ((quotes & quoted & ~(open << 1 | csv_open)) == 0) {
+		csv_ends = ends & ~quoted;
+		csv_quoted = -(quoted >> 63);
+		csv_open = open >> (n-1) & 1;
+		return;
+	}
+
+	st = csv_quoted ? CSV_QUOTED : csv_open ? CSV_OPEN : 0;
+	csv_ends = 0;
+
+	for (i = 0; i < n; i++) {
+		c = buf[csv_block+i];
+		st = csv_state(st, c);
+		csv_ends |= (uint64_t)(st == CSV_OPEN && c != L'"') << i;
+	}
+
+	csv_quoted = st == CSV_QUOTED ? -1 : 0;
+	csv_open = st == CSV_OPEN;
+}
+
+/* Returns the end of the CSV field starting at i. An unterminated quote
+ * extends the field to the newline at the end of input. */
+static size_t
+csv_end(size_t i) {
+	size_t end;
+
+	for (;;) {
+		while (csv_ends == 0) {
+			if (csv_next >= buf_len)
+				return buf_len-1;
+
+			csv_block = csv_next;
+			csv_next += 64;
+			scan_block();
+		}
+
+		end = csv_block + trailing_zeros(csv_ends);
+		csv_ends &= csv_ends-1;
+
+		if (end >= i)
+			return end;
+	}
+}
+
+/* Parses a CSV field, removing quotes in place. Line breaks inside quotes
+ * are replaced with spaces so as not to break the table, and so is the
+ * carriage return ending a CRLF row. */
+static size_t
+parse_quoted(size_t begin, struct item *dst) {
+	size_t end, i, j, k, n, width;
+	wchar_t c;
+	int st, x;
+
+	end = csv_end(begin);
+
+	j = begin;
+	st = CSV_OPEN;
+
+	if (end > begin && buf[end-1] == L'\r' && buf[end] == L'\n')
+		end--;
+
+	for (i = begin; i < end; i++) {
+		c = buf[i];
+
+		if (c == L'"' && st == CSV_QUOTED && i+1 < end
+				&& buf[i+1] == L'"') {
+			buf[j++] = c;
+			i++;
+			continue;
+		}
+		else if (c == L'"' && st != 0) {
+			st = csv_state(st, c);
+			continue;
+		}
+
+		st = csv_state(st, c);
 
-		if (truncated)
+		if (c == L'\r' && st == CSV_QUOTED && buf[i+1] == L'\n')
 			continue;
+		else if (c == L'\n' || c == L'\r')
+			c = L' ';
 
-		x = xwcwidth(buf[i]);
-		if (!cols_fixed && width+x > term_width) {
-			truncated = 1;
+		buf[j++] = c;
+	}
+
+	width = 0;
+	for (i = begin; i < j; i++) {
+		if (colors && (k = skip_color(i)) != i && k < j) {
+			i = k;
 			continue;
 		}
 
-		len++;
+		n = measure_cluster(i, j-i, &x);
 		width += x;
+		i += n-1;
 	}
 
 	dst->text = &buf[begin];
-	dst->len = len;
+	dst->len = j-begin;
 	dst->width = width;
 
-	if (truncated)
-		status = 1;
-
-	return i;
+	return buf[end] == L'\r' ? end+1 : end;
 }
 
 static void
@@ -587,8 +1382,169 @@ end_of_row(size_t fields) {
 		num_cols = fields;
 }
 
+static int
+field_selected(size_t field) {
+	size_t j;
+
+	for (j = 0; j < field_list_len; j++)
+		if (field_list[j] == field+1)
+			return 1;
+
+	return 0;
+}
+
+/* Skips a field that is not selected with -f. Nothing after the last
+ * selected field is looked at but the end of the row. */
+static size_t
+skip_field(size_t i, size_t field) {
+	const wchar_t *p;
+
+	if (field < field_max)
+		return skip_item(i);
+
+	p = wmemchr(&buf[i], L'\n', buf_len-i);
+	if (p == NULL)
+		return buf_len;
+
+	return p-buf;
+}
+
+static void
+pick_field(size_t field, const struct item *p) {
+	size_t j;
+
+	for (j = 0; j < field_list_len; j++) {
+		if (field_list[j] != field+1)
+			continue;
+
+		picked[j] = *p;
+		if (j >= picked_len)
+			picked_len = j+1;
+	}
+}
+
+static uint64_t
+hash_text(const wchar_t *s, size_t n) {
+	uint64_t h;
+	size_t i;
+
+	h = UINT64_C(14695981039346656037);
+	for (i = 0; i < n; i++) {
+		h ^= (uint64_t)s[i];
+		h *= UINT64_C(1099511628211);
+	}
+
+	return h;
+}
+
+/* Looks the text of p up among the first n items of set, which are kept in the
+ * hash table seen, and returns the index of the one with the same text. If
+ * there is none, p is inserted with the index n, which is returned. The table
+ * is open-addressed and kept at most half full. */
+static size_t
+find_seen(const struct item *set, size_t n, const struct item *p) {
+	size_t mask, i, j, k;
+	const struct item *q;
+
+	if (n >= seen_alloc/2) {
+		free(seen);
+		seen_alloc = seen_alloc ? seen_alloc*2 : 64;
+		seen = xmalloc(seen_alloc*sizeof seen[0]);
+
+		for (i = 0; i < seen_alloc; i++)
+			seen[i] = SIZE_MAX;
+
+		mask = seen_alloc-1;
+		for (k = 0; k < n; k++) {
+			q = &set[k];
+			i = hash_text(q->text, q->len) & mask;
+			while (seen[i] != SIZE_MAX)
+				i = (i+1) & mask;
+
+			seen[i] = k;
+		}
+	}
+
+	mask = seen_alloc-1;
+	for (i = hash_text(p->text, p->len) & mask; (j = seen[i]) != SIZE_MAX;
+			i = (i+1) & mask) {
+		q = &set[j];
+		if (q->len == p->len && !wmemcmp(q->text, p->text, p->len))
+			return j;
+	}
+
+	seen[i] = n;
+
+	return n;
+}
+
+/* Returns the width of the text between begin and end. */
+static size_t
+measure_text(size_t begin, size_t end) {
+	size_t i, j, n, width;
+	int x;
+
+	width = 0;
+	for (i = begin; i < end; i++) {
+		if (colors && (j = skip_color(i)) != i && j < end) {
+			i = j;
+			continue;
+		}
+
+		n = measure_cluster(i, end-i, &x);
+		width += x;
+		i += n-1;
+	}
+
+	return width;
+}
+
+/* Saves a cell as the index of its value among the distinct values seen so
+ * far. A value is measured only the first time it is seen; cells found by
+ * cell_end() come with SIZE_MAX as their width. */
+static void
+save_interned(const struct item *p) {
+	size_t id;
+
+	id = find_seen(values, values_len, p);
+
+	if (id == values_len) {
+		if (values_len >= values_alloc) {
+			values_alloc = values_alloc ? values_alloc*2 : 64;
+			values = xrealloc(values, values_alloc*sizeof values[0]);
+		}
+
+		values[id] = *p;
+		if (p->width == SIZE_MAX)
+			values[id].width = measure_text(p->text-buf,
+				p->text-buf + p->len);
+
+		values_len++;
+	}
+
+	if (list_len >= ids_alloc) {
+		if (list_len >= UINT32_MAX) {
+			errno = EOVERFLOW;
+			die("-U");
+		}
+
+		ids_alloc = ids_alloc ? ids_alloc*2 : 64;
+		ids = xrealloc(ids, ids_alloc*sizeof ids[0]);
+	}
+
+	ids[list_len++] = id;
+}
+
 static void
 save_item(const struct item *p) {
+	if (unique && find_seen(list, list_len, p) != list_len)
+		return;
+
+	if (intern) {
+		save_interned(p);
+		return;
+	}
+
 	if (list_len >= list_alloc) {
 		list_alloc *= 2;
 		list = xrealloc(list, list_alloc*sizeof list[0]);
@@ -597,46 +1553,237 @@ save_item(const struct item *p) {
 	list[list_len++] = *p;
 }
 
+/* Saves the fields picked from a row in the order they were selected in,
+ * filling those missing from the row with empty items. */
+static void
+save_picked(void) {
+	static const struct item empty = {L"", 0, 0};
+	size_t j, n;
+
+	n = picked_len > 0 ? picked_len : 1;
+
+	for (j = 0; j < n; j++) {
+		if (j == n-1)
+			end_of_row(n);
+
+		save_item(picked[j].text ? &picked[j] : &empty);
+		picked[j].text = NULL;
+	}
+
+	picked_len = 0;
+}
+
+/* Tells whether the item, or the row in table mode, that the character at i
+ * belongs to ends there, given that it began at begin. Returns the length of
+ * the page if so, which is more than i if the decision had to be deferred
+ * until the next character was read. */
+static size_t
+page_end(size_t begin, size_t i) {
+	if (table)
+		return buf[i] == L'\n' ? i+1 : 0;
+	else if (!words)
+		return i+1-begin >= delim_len && buf[i] == delim_str[delim_len-1]
+		    && !wmemcmp(&buf[i+1-delim_len], delim_str, delim_len) ? i+1 : 0;
+	else if (i >= 2 && is_delim(i-1) && !is_delim(i-2))
+		return i;
+
+	return 0;
+}
+
+/* Reads input until page_size items, or rows in table mode, have been
+ * completed, and returns the length of the page. What follows it in buf
+ * belongs to the next page. */
+static size_t
+slurp_page(void) {
+	size_t i, n, begin, end;
+	wint_t c;
+	int st;
+
+	if (buf == NULL)
+		buf = xmalloc(buf_alloc*sizeof buf[0]);
+
+	n = 0;
+	begin = 0;
+	st = CSV_OPEN;
+	for (i = 0; ; i++) {
+		if (i >= buf_len) {
+			if ((c = read_char()) == WEOF)
+				break;
+
+			if (buf_len >= buf_alloc) {
+				buf_alloc *= 2;
+				buf = xrealloc(buf, buf_alloc*sizeof buf[0]);
+			}
+
+			buf[buf_len++] = c;
+		}
+
+		if (csv)
+			st = csv_state(st, buf[i]);
+
+		if (st != CSV_QUOTED && (end = page_end(begin, i))) {
+			if (++n == page_size)
+				return end;
+
+			begin = end;
+		}
+	}
+
+	if (ferror(stdin))
+		die("stdin");
+
+	return buf_len;
+}
+
+/* Makes room for n more characters in buf. Items point into it, so it is
+ * moved by hand in order to point them into the new copy. */
+static void
+reserve(size_t n) {
+	wchar_t *p;
+	size_t i;
+
+	if (buf != NULL && buf_len+n <= buf_alloc)
+		return;
+
+	while (buf_len+n > buf_alloc)
+		buf_alloc *= 2;
+
+	p = xmalloc(buf_alloc*sizeof p[0]);
+	if (buf_len > 0)
+		wmemcpy(p, buf, buf_len);
+
+	if (intern)
+		for (i = 0; i < values_len; i++)
+			values[i].text = p + (values[i].text-buf);
+	else
+		for (i = 0; i < list_len; i++)
+			list[i].text = p + (list[i].text-buf);
+
+	free(buf);
+	buf = p;
+}
+
+/* Reads input until an empty item, which ends a group of items in
+ * incremental mode, has been read. Returns 0 at the end of input. */
+static int
+slurp_group(void) {
+	size_t begin;
+	wint_t c;
+
+	begin = buf_len;
+	while ((c = read_char()) != WEOF) {
+		reserve(1);
+		buf[buf_len++] = c;
+
+		if (page_end(begin, buf_len-1)) {
+			if (buf_len-begin == delim_len)
+				return 1;
+
+			begin = buf_len;
+		}
+	}
+
+	if (ferror(stdin))
+		die("stdin");
+
+	return 0;
+}
+
+static int
+blank_line(size_t begin, size_t end) {
+	const wchar_t *p;
+
+	p = wmemchr(&buf[begin], L'\n', end-begin);
+	if (p == NULL)
+		return 0;
+
+	return wmemchr(p+1, L'\n', &buf[end] - (p+1)) != NULL;
+}
+
+/* Parses the list starting at next_list. In batch mode, lists are separated
+ * by empty items; that is, by empty lines in table mode and by blank lines in
+ * -s and -S modes. */
 static void
 parse_list(void) {
 	size_t i, end;
 	struct item item;
 	size_t fields;
-	int eol;
-
-	init_parse();
+	int eol, last, skipped;
 
 	if (words)
-		i = skip_spaces(0);
+		i = skip_spaces(next_list);
 	else
-		i = 0;
+		i = next_list;
+
+	csv_next = i;
+	csv_ends = 0;
+	csv_quoted = 0;
+	csv_open = 1;
 
 	fields = 0;
+	last = 0;
 
 	while (i < buf_len) {
-		if (table && fields >= tail-1)
+		skipped = 0;
+
+		if (table && fields >= tail-1) {
 			end = parse_tail(i, &item);
-		else
+		}
+		else if (table && field_list_len && !field_selected(fields)) {
+			end = csv ? csv_end(i) : skip_field(i, fields);
+			skipped = 1;
+		}
+		else if (csv) {
+			end = parse_quoted(i, &item);
+		}
+		else if (intern) {
+			end = cell_end(i);
+			item.text = &buf[i];
+			item.len = end-i;
+			item.width = SIZE_MAX;
+		}
+		else {
 			end = parse_item(i, &item);
+		}
+
+		if ((batch || grow) && end == i && (!table || (fields == 0
+				&& buf[end] == L'\n'))) {
+			i = table ? end+1 : end+delim_len;
+			break;
+		}
+
+		if (words) {
+			if (batch && !table && blank_line(end, skip_spaces(end)))
+				last = 1;
 
-		if (words)
 			end = skip_spaces(end);
+		}
 
 		if (table) {
 			fields++;
-			eol = 0;
+			eol = buf[end] == L'\n';
+		}
 
-			if (buf[end] == L'\n') {
-				end_of_row(fields);
+		if (!skipped && !nuls)
+			buf[i+item.len] = L'\0';
+
+		if (table && field_list_len) {
+			if (!skipped)
+				pick_field(fields-1, &item);
+
+			if (eol) {
+				save_picked();
 				fields = 0;
-				eol = 1;
 			}
 		}
+		else {
+			if (table && eol) {
+				end_of_row(fields);
+				fields = 0;
+			}
 
-		if (!nuls)
-			buf[i+item.len] = L'\0';
-
-		save_item(&item);
+			save_item(&item);
+		}
 
 		if (words) {
 			if (table && eol)
@@ -644,397 +1791,2458 @@ parse_list(void) {
 			else
 				i = end;
 		}
-		else {
+		else if (table && eol) {
 			i = end+1;
 		}
+		else {
+			i = end+delim_len;
+		}
+
+		if (last)
+			break;
 	}
 
-	if (list_len == 0)
-		exit(0);
+	next_list = i;
 }
 
-static size_t
-calc_from(size_t x) {
-	size_t y;
+/* A ring of buffers that a reader thread fills with input while the main
+ * thread decodes and parses what has been read so far. */
+#define RING_LEN 4
+#define CHUNK_SIZE 65536
+
+struct ring {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char *chunks[RING_LEN];
+	size_t lens[RING_LEN];
+	size_t head;
+	size_t tail;
+	int eof;
+	int error;
+};
 
-	y = list_len/x;
-	if (list_len%x)
-		y++;
+static void *
+read_chunks(void *arg) {
+	struct ring *r;
+	char *p;
+	ssize_t n;
 
-	return y;
+	r = arg;
+
+	for (;;) {
+		pthread_mutex_lock(&r->lock);
+		while (r->head-r->tail == RING_LEN)
+			pthread_cond_wait(&r->cond, &r->lock);
+
+		p = r->chunks[r->head%RING_LEN];
+		pthread_mutex_unlock(&r->lock);
+
+		do
+			n = read(0, p, CHUNK_SIZE);
+		while (n == -1 && errno == EINTR);
+
+		pthread_mutex_lock(&r->lock);
+		if (n > 0) {
+			r->lens[r->head%RING_LEN] = n;
+			r->head++;
+		}
+		else {
+			r->eof = 1;
+			r->error = n == -1 ? errno : 0;
+		}
+
+		pthread_cond_signal(&r->cond);
+		pthread_mutex_unlock(&r->lock);
+
+		if (n <= 0)
+			return NULL;
+	}
 }
 
-/* Maps each item to the next item with greater width. This helps find the
- * widest item in a column quickly. */
+/* Appends a chunk of input to buf. A character cut in two by the end of the
+ * chunk is completed by the next one through ps. */
 static void
-init_lut(void) {
-	size_t i, j;
+decode_chunk(const char *p, size_t n, mbstate_t *ps) {
+	size_t i, x;
+	wchar_t c;
 
-	wider = xmalloc(list_len*sizeof wider[0]);
+	reserve(n);
 
-	for (i = list_len; i-- > 0; ) {
-		for (j = i+1; j < list_len; j = wider[j])
-			if (list[j].width > list[i].width)
+	if (bytes) {
+		for (i = 0; i < n; i++)
+			buf[buf_len++] = (unsigned char)p[i];
+
+		return;
+	}
+
+	for (i = 0; i < n; i += x) {
+		x = mbrtowc(&c, &p[i], n-i, ps);
+		if (x == (size_t)-2)
+			break;
+		else if (x == (size_t)-1)
+			die("stdin");
+		else if (x == 0)
+			x = 1;
+
+		buf[buf_len++] = c;
+	}
+}
+
+/* Parses the items completed since the last call, and returns where the next
+ * one begins. Items are found the same way pages are, so a cut is never made
+ * where the input read so far cannot tell whether an item ends. */
+static size_t
+parse_completed(size_t scan, size_t *begin, int *st) {
+	size_t end, len;
+
+	for (; scan < buf_len; scan++) {
+		if (csv)
+			*st = csv_state(*st, buf[scan]);
+
+		if (*st != CSV_QUOTED && (end = page_end(*begin, scan)))
+			*begin = end;
+	}
+
+	if (*begin > next_list) {
+		if (!nuls && (words || delim_len > 1 || delim != L'\0'))
+			nuls = wmemchr(&buf[next_list], L'\0',
+			    *begin-next_list) != NULL;
+
+		len = buf_len;
+		buf_len = *begin;
+		parse_list();
+		buf_len = len;
+	}
+
+	return scan;
+}
+
+/* Reads and parses the input at the same time, if it is a pipe or a socket.
+ * Returns 0 if it is neither, or if the reader thread cannot be started, in
+ * which case nothing has been read. */
+static int
+slurp_pipelined(void) {
+	struct ring r;
+	struct stat st;
+	pthread_t tid;
+	mbstate_t ps;
+	size_t i, scan, begin, n;
+	const char *p;
+	int state;
+
+	if (fstat(0, &st) == -1
+			|| !(S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)))
+		return 0;
+
+	memset(&r, 0, sizeof r);
+	pthread_mutex_init(&r.lock, NULL);
+	pthread_cond_init(&r.cond, NULL);
+
+	for (i = 0; i < RING_LEN; i++)
+		r.chunks[i] = xmalloc(CHUNK_SIZE);
+
+	if (pthread_create(&tid, NULL, read_chunks, &r) != 0) {
+		for (i = 0; i < RING_LEN; i++)
+			free(r.chunks[i]);
+
+		return 0;
+	}
+
+	list = xmalloc(list_alloc*sizeof list[0]);
+	if (table)
+		rows = xmalloc(rows_alloc*sizeof rows[0]);
+
+	memset(&ps, 0, sizeof ps);
+	scan = 0;
+	begin = 0;
+	state = CSV_OPEN;
+
+	for (;;) {
+		pthread_mutex_lock(&r.lock);
+		while (r.head == r.tail && !r.eof)
+			pthread_cond_wait(&r.cond, &r.lock);
+
+		if (r.head == r.tail) {
+			pthread_mutex_unlock(&r.lock);
+			break;
+		}
+
+		p = r.chunks[r.tail%RING_LEN];
+		n = r.lens[r.tail%RING_LEN];
+		pthread_mutex_unlock(&r.lock);
+
+		decode_chunk(p, n, &ps);
+
+		pthread_mutex_lock(&r.lock);
+		r.tail++;
+		pthread_cond_signal(&r.cond);
+		pthread_mutex_unlock(&r.lock);
+
+		scan = parse_completed(scan, &begin, &state);
+	}
+
+	pthread_join(tid, NULL);
+
+	for (i = 0; i < RING_LEN; i++)
+		free(r.chunks[i]);
+
+	if (r.error) {
+		errno = r.error;
+		die("stdin");
+	}
+
+	if (!bytes && !mbsinit(&ps)) {
+		errno = EILSEQ;
+		die("stdin");
+	}
+
+	if (buf_len == 0)
+		exit(0);
+
+	if (!nuls && (words || delim_len > 1 || delim != L'\0'))
+		nuls = wmemchr(&buf[next_list], L'\0', buf_len-next_list) != NULL;
+
+	/* Unless the input ended with an item, whose delimiter may have been
+	 * overwritten by now. */
+	if (next_list < buf_len) {
+		reserve(delim_len);
+		fix_eof();
+		parse_list();
+	}
+
+	return 1;
+}
+
+/* Maps a regular file on the standard input into memory, provided that the
+ * delimiter can be searched for byte-wise in the current encoding. */
+static int
+map_input(void) {
+	struct stat st;
+	off_t off;
+	void *p;
+
+	if (!bytes && MB_CUR_MAX > 1 && strcmp(nl_langinfo(CODESET), "UTF-8"))
+		return 0;
+
+	if (fstat(0, &st) == -1 || !S_ISREG(st.st_mode))
+		return 0;
+
+	off = lseek(0, 0, SEEK_CUR);
+	if (off == -1 || off >= st.st_size
+			|| (uintmax_t)st.st_size > SIZE_MAX)
+		return 0;
+
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, 0, 0);
+	if (p == MAP_FAILED)
+		return 0;
+
+	map = (const char *)p + off;
+	map_len = st.st_size - off;
+
+	return 1;
+}
+
+/* Measures the item in map between begin and end, truncating it if it is
+ * too wide. Characters are decoded into cl until they end a grapheme cluster,
+ * which is measured and cut as a whole. */
+static void
+measure_mapped(size_t begin, size_t end, struct item *dst) {
+	mbstate_t ps;
+	wchar_t c, cl[CLUSTER_MAX];
+	size_t i, n, start, len, width;
+	int x;
+
+	memset(&ps, 0, sizeof ps);
+	width = 0;
+	len = 0;
+	start = begin;
+
+	for (i = begin; ; i += n) {
+		if (i >= end) {
+			c = 0;
+			n = 0;
+		}
+		else if (bytes) {
+			c = (unsigned char)map[i];
+			n = 1;
+		}
+		else {
+			n = mbrtowc(&c, &map[i], end-i, &ps);
+			if (n == (size_t)-1 || n == (size_t)-2) {
+				memset(&ps, 0, sizeof ps);
+				c = 0;
+				n = 1;
+			}
+			else if (n == 0) {
+				n = 1;
+			}
+		}
+
+		if (i < end && len > 0 && len < CLUSTER_MAX) {
+			cl[len] = c;
+			if (extends(cl, len)) {
+				len++;
+				continue;
+			}
+		}
+
+		if (len > 0) {
+			x = cluster_width(cl, len);
+			if (!cols_fixed && width+x > term_width) {
+				status = 1;
+				i = start;
 				break;
+			}
 
-		wider[i] = j;
+			width += x;
+		}
+
+		if (i >= end)
+			break;
+
+		cl[0] = c;
+		len = 1;
+		start = i;
 	}
+
+	dst->text = NULL;
+	dst->len = i-begin;
+	dst->width = width;
 }
 
+/* Only the widths and offsets of items are kept in memory; their text is
+ * printed straight from the mapping. */
 static void
-init_calc(void) {
-	size_t max_cols;
+parse_map(void) {
+	char *d;
+	size_t dlen, len, i, n;
+	const char *p;
+	mbstate_t ps;
+	struct item item;
 
-	if (table) {
-		max_cols = num_cols;
+	d = xmalloc(delim_len*MB_LEN_MAX);
+	memset(&ps, 0, sizeof ps);
+
+	for (i = 0, dlen = 0; i < delim_len; i++, dlen += n) {
+		if (bytes) {
+			d[dlen] = delim_str[i];
+			n = 1;
+		}
+		else if ((n = wcrtomb(&d[dlen], delim_str[i], &ps)) == (size_t)-1) {
+			die("-d");
+		}
 	}
-	else if (cols_fixed) {
-		if (num_cols > list_len)
-			max_cols = list_len;
-		else if (across)
-			max_cols = num_cols;
+
+	len = map_len;
+	if ((len < dlen || memcmp(&map[len-dlen], d, dlen))
+			&& map[len-1] == '\n')
+		len--;
+
+	list = xmalloc(list_alloc*sizeof list[0]);
+
+	/* As with fix_eof(), a final newline ends the last item, even if that
+	 * is empty. */
+	for (i = 0; i < len || (i == len && len < map_len); i = p-map + dlen) {
+		if (dlen == 1)
+			p = memchr(&map[i], d[0], len-i);
 		else
-			max_cols = calc_from(calc_from(num_cols));
+			p = memmem(&map[i], len-i, d, dlen);
 
-		surplus = (num_cols-max_cols)*padding;
+		if (p == NULL)
+			p = &map[len];
+
+		if (offs_alloc < list_alloc) {
+			offs_alloc = list_alloc;
+			offs = xrealloc(offs, offs_alloc*sizeof offs[0]);
+		}
+
+		offs[list_len] = i;
+
+		measure_mapped(i, p-map, &item);
+		save_item(&item);
 	}
-	else {
-		if (padding == 0) 
-			max_cols = list_len;
-		else
-			max_cols = MIN(term_width/padding + 1, list_len);
+
+	free(d);
+}
+
+/* Maps the standard input, or reads it into memory if it cannot be mapped, to
+ * load records from. */
+static void
+load_records(void) {
+	char *p;
+	size_t n, alloc;
+	ssize_t x;
+
+	if (map_input())
+		return;
+
+	alloc = CHUNK_SIZE;
+	p = xmalloc(alloc);
+
+	for (n = 0; (x = read(0, &p[n], alloc-n)) != 0; n += x) {
+		if (x == -1 && errno == EINTR) {
+			x = 0;
+		}
+		else if (x == -1) {
+			die("stdin");
+		}
+		else if (n+x == alloc) {
+			alloc *= 2;
+			p = xrealloc(p, alloc);
+		}
 	}
 
-	if (across) {
-		num_cols = max_cols;
+	map = p;
+	map_len = n;
+}
+
+/* Reads a decimal number at map[*i], advancing *i past it. */
+static int
+parse_count(size_t *i, size_t *dst) {
+	size_t x, j;
+	int d;
+
+	x = 0;
+	for (j = *i; j < map_len && map[j] >= '0' && map[j] <= '9'; j++) {
+		d = map[j] - '0';
+		if (x > (SIZE_MAX-d)/10)
+			return 0;
+
+		x = x*10 + d;
 	}
-	else if (!table) {
-		init_lut();
-		num_rows = calc_from(max_cols);
+
+	if (j == *i)
+		return 0;
+
+	*i = j;
+	*dst = x;
+
+	return 1;
+}
+
+/* Loads records of the form length[,width]:text, where length is the size of
+ * text in bytes, straight into the list. The text is neither scanned nor
+ * measured unless the width is left out or the item has to be truncated. A
+ * newline may follow each record. */
+static void
+parse_records(void) {
+	size_t i, len, width;
+	int ok, measured;
+	struct item item;
+
+	list = xmalloc(list_alloc*sizeof list[0]);
+
+	for (i = 0; i < map_len; i += len) {
+		if (map[i] == '\n') {
+			len = 1;
+			continue;
+		}
+
+		ok = parse_count(&i, &len);
+		measured = ok && i < map_len && map[i] == ',';
+		if (measured) {
+			i++;
+			ok = parse_count(&i, &width);
+		}
+
+		if (!ok || i >= map_len || map[i++] != ':' || len > map_len-i) {
+			errno = EINVAL;
+			die("stdin");
+		}
+
+		if (offs_alloc < list_alloc) {
+			offs_alloc = list_alloc;
+			offs = xrealloc(offs, offs_alloc*sizeof offs[0]);
+		}
+
+		offs[list_len] = i;
+
+		if (measured && (cols_fixed || width <= term_width)) {
+			item.text = NULL;
+			item.len = len;
+			item.width = width;
+		}
+		else {
+			measure_mapped(i, i+len, &item);
+		}
+
+		save_item(&item);
 	}
+}
+
+static int
+compare_text(const struct item *p, const struct item *q) {
+	int x;
 
-	cols = xmalloc(max_cols*sizeof cols[0]);
+	x = wmemcmp(p->text, q->text, MIN(p->len, q->len));
+	if (x != 0)
+		return x;
+
+	return (p->len > q->len) - (p->len < q->len);
 }
 
-static size_t
-max_width(size_t col) {
-	size_t i, j;
+static int
+compare_items(const void *a, const void *b) {
+	const struct item *p, *q;
+	int x;
 
-	i = col*num_rows;
-	j = MIN(i+num_rows, list_len);
+	p = a;
+	q = b;
 
-	while (wider[i] < j)
-		i = wider[i];
+	if (order == 'c' && !nuls && !bytes && (x = wcscoll(p->text, q->text)))
+		return x;
+
+	return compare_text(p, q);
+}
+
+struct number {
+	double value;
+	size_t i;
+};
+
+static int
+compare_numbers(const void *a, const void *b) {
+	const struct number *p, *q;
+
+	p = a;
+	q = b;
+
+	if (p->value != q->value)
+		return (p->value > q->value) - (p->value < q->value);
+
+	return compare_text(&list[p->i], &list[q->i]);
+}
+
+struct sort_job {
+	char *src;
+	char *dst;
+	size_t size;
+	int (*compare)(const void *, const void *);
+	size_t begin;
+	size_t mid;
+	size_t end;
+};
+
+static void *
+sort_part(void *arg) {
+	struct sort_job *job;
+
+	job = arg;
+	qsort(job->src + job->begin*job->size, job->end-job->begin, job->size,
+		job->compare);
+
+	return NULL;
+}
+
+static void *
+merge_parts(void *arg) {
+	struct sort_job *job;
+	char *p, *q, *mid, *end, *dst;
+	size_t size;
+
+	job = arg;
+	size = job->size;
+	p = job->src + job->begin*size;
+	q = mid = job->src + job->mid*size;
+	end = job->src + job->end*size;
+
+	for (dst = job->dst + job->begin*size; p < mid || q < end; dst += size)
+		if (q >= end || (p < mid && job->compare(p, q) <= 0)) {
+			memcpy(dst, p, size);
+			p += size;
+		}
+		else {
+			memcpy(dst, q, size);
+			q += size;
+		}
+
+	return NULL;
+}
+
+static void
+run_jobs(void *(*f)(void *), struct sort_job *jobs, size_t n) {
+	pthread_t tids[16];
+	int started[16];
+	size_t i;
+
+	for (i = 1; i < n; i++)
+		started[i] = pthread_create(&tids[i], NULL, f, &jobs[i]) == 0;
+
+	f(&jobs[0]);
+
+	for (i = 1; i < n; i++)
+		if (started[i])
+			pthread_join(tids[i], NULL);
+		else
+			f(&jobs[i]);
+}
+
+/* Sorts an array of len elements by cutting it into as many parts as there
+ * are processors, sorting the parts in parallel, and then merging them
+ * pairwise, also in parallel. Returns either the array or tmp, whichever
+ * holds the result. */
+static void *
+par_sort(void *base, void *tmp, size_t len, size_t size,
+		int (*compare)(const void *, const void *)) {
+	struct sort_job jobs[16];
+	size_t bounds[17];
+	char *src, *dst;
+	size_t n, i, k;
+	long x;
+
+	x = sysconf(_SC_NPROCESSORS_ONLN);
+	n = x > 1 ? x : 1;
+	n = MIN(n, sizeof jobs/sizeof jobs[0]);
+	n = MIN(n, len/32768 + 1);
+
+	for (i = 0; i <= n; i++)
+		bounds[i] = len/n*i + MIN(i, len%n);
+
+	for (i = 0; i < n; i++) {
+		jobs[i].src = base;
+		jobs[i].size = size;
+		jobs[i].compare = compare;
+		jobs[i].begin = bounds[i];
+		jobs[i].end = bounds[i+1];
+	}
+
+	run_jobs(sort_part, jobs, n);
+
+	src = base;
+	dst = tmp;
+
+	while (n > 1) {
+		for (i = 0, k = 0; i < n; i += 2, k++) {
+			jobs[k].src = src;
+			jobs[k].dst = dst;
+			jobs[k].begin = bounds[i];
+			jobs[k].mid = bounds[MIN(i+1, n)];
+			jobs[k].end = bounds[MIN(i+2, n)];
+			bounds[k] = bounds[i];
+		}
+
+		bounds[k] = bounds[n];
+		run_jobs(merge_parts, jobs, k);
+
+		n = k;
+		dst = src;
+		src = jobs[0].dst;
+	}
+
+	return src;
+}
+
+/* In numeric order, the number each item begins with is parsed only once and
+ * sorted along with the index of the item. Items are not terminated, so each
+ * is copied before being parsed. Like items without a number, NaN has the
+ * value 0, since it does not compare with anything. */
+static void
+sort_list(void) {
+	struct number *nums, *p;
+	struct item *tmp, *sorted;
+	wchar_t *s;
+	size_t i, n;
+
+	tmp = xmalloc(list_alloc*sizeof tmp[0]);
+
+	if (order == 'n') {
+		nums = xmalloc(2*list_len*sizeof nums[0]);
+
+		for (i = 0, n = 0; i < list_len; i++)
+			n = MAX(n, list[i].len);
+
+		s = xmalloc((n+1)*sizeof s[0]);
+
+		for (i = 0; i < list_len; i++) {
+			wmemcpy(s, list[i].text, list[i].len);
+			s[list[i].len] = L'\0';
+			nums[i].value = wcstod(s, NULL);
+			if (isnan(nums[i].value))
+				nums[i].value = 0;
+
+			nums[i].i = i;
+		}
+
+		free(s);
+
+		p = par_sort(nums, &nums[list_len], list_len, sizeof nums[0],
+			compare_numbers);
+
+		for (i = 0; i < list_len; i++)
+			tmp[i] = list[p[i].i];
+
+		free(nums);
+		sorted = tmp;
+	}
+	else {
+		if (order == 'c' && !bytes)
+			setlocale(LC_COLLATE, "");
+
+		sorted = par_sort(list, tmp, list_len, sizeof list[0],
+			compare_items);
+	}
+
+	if (sorted == list) {
+		free(tmp);
+	}
+	else {
+		free(list);
+		list = sorted;
+	}
+}
+
+static size_t
+calc_from(size_t x) {
+	size_t y;
+
+	y = list_len/x;
+	if (list_len%x)
+		y++;
+
+	return y;
+}
+
+/* Maps each item to the next item with greater width. This helps find the
+ * widest item in a column quickly. */
+static void
+init_lut(void) {
+	size_t i, j;
+
+	if (list_len > wider_alloc) {
+		wider_alloc = list_len;
+		free(wider);
+		wider = xmalloc(wider_alloc*sizeof wider[0]);
+	}
+
+	for (i = list_len; i-- > 0; ) {
+		for (j = i+1; j < list_len; j = wider[j])
+			if (list[j].width > list[i].width)
+				break;
+
+		wider[i] = j;
+	}
+}
+
+/* Extends the map to items appended since it was last updated, in amortized
+ * constant time per item. Items not yet followed by a wider one are kept on
+ * a stack, narrowest on top, and map to SIZE_MAX until one is appended. */
+static void
+update_lut(void) {
+	size_t i, j;
+
+	if (list_len > wider_alloc) {
+		wider_alloc = MAX(list_len, wider_alloc*2);
+		wider = xrealloc(wider, wider_alloc*sizeof wider[0]);
+		pending = xrealloc(pending, wider_alloc*sizeof pending[0]);
+	}
+
+	for (i = lut_len; i < list_len; i++) {
+		while (pending_len > 0) {
+			j = pending[pending_len-1];
+			if (list[j].width >= list[i].width)
+				break;
+
+			wider[j] = i;
+			pending_len--;
+		}
+
+		wider[i] = SIZE_MAX;
+		pending[pending_len++] = i;
+	}
+
+	lut_len = list_len;
+}
+
+static void
+init_calc(void) {
+	size_t max_cols;
+
+	if (table) {
+		max_cols = num_cols;
+	}
+	else if (cols_fixed) {
+		if (num_cols > list_len)
+			max_cols = list_len;
+		else if (across)
+			max_cols = num_cols;
+		else
+			max_cols = calc_from(calc_from(num_cols));
+
+		surplus = (num_cols-max_cols)*padding;
+	}
+	else {
+		if (padding == 0) 
+			max_cols = list_len;
+		else
+			max_cols = MIN(term_width/padding + 1, list_len);
+	}
+
+	if (across) {
+		num_cols = MIN(max_cols, max_across);
+	}
+	else if (!table) {
+		if (grow)
+			update_lut();
+		else
+			init_lut();
+
+		num_rows = calc_from(max_cols);
+
+		if (num_rows < min_rows)
+			num_rows = min_rows;
+	}
+
+	if (max_cols > cols_alloc) {
+		cols_alloc = max_cols;
+		free(cols);
+		cols = xmalloc(cols_alloc*sizeof cols[0]);
+	}
+}
+
+static size_t
+max_width(size_t col) {
+	size_t i, j;
+
+	i = col*num_rows;
+	j = MIN(i+num_rows, list_len);
+
+	while (wider[i] < j)
+		i = wider[i];
+
+	return list[i].width;
+}
+
+static void
+init_cols(void) {
+	size_t i;
+
+	for (i = 0; i < num_cols; i++)
+		cols[i].width = max_width(i);
+}
+
+static void
+init_cols_across(void) {
+	size_t col, i;
+
+	for (i = 0; i < num_cols; i++)
+		cols[i].width = list[i].width;
+
+	col = 0;
+	for (; i < list_len; i++) {
+		if (list[i].width > cols[col].width)
+			cols[col].width = list[i].width;
+
+		col++;
+		if (col >= num_cols)
+			col = 0;
+	}
+}
+
+/* The widths of each row are copied into a dense array, so that the loop
+ * taking column maximums over it can be vectorized, and each column is given
+ * the total width of the columns following it so that short rows can be
+ * padded at once. */
+static void
+init_cols_table(void) {
+	size_t row, col, i, n;
+	size_t *max, *w;
+	size_t x;
+
+	max = xmalloc(num_cols*sizeof max[0]);
+	w = xmalloc(num_cols*sizeof w[0]);
+
+	for (col = 0; col < num_cols; col++)
+		max[col] = 0;
+
+	i = 0;
+	for (row = 0; row < num_rows; row++) {
+		n = rows[row].last+1 - i;
+
+		if (intern)
+			for (col = 0; col < n; col++)
+				w[col] = values[ids[i+col]].width;
+		else
+			for (col = 0; col < n; col++)
+				w[col] = list[i+col].width;
+
+		for (col = 0; col < n; col++)
+			max[col] = w[col] > max[col] ? w[col] : max[col];
+
+		i += n;
+	}
+
+	x = 0;
+	for (col = num_cols; col-- > 0; ) {
+		cols[col].width = max[col];
+		cols[col].rest = x;
+		x += padding+max[col];
+	}
+
+	free(w);
+	free(max);
+}
+
+static int
+fits(void) {
+	size_t width;
+	size_t i;
+
+	width = (num_cols-1)*padding;
+	if (width > term_width)
+		return 0;
+
+	for (i = 0; i < num_cols; i++) {
+		width += max_width(i);
+		if (width > term_width)
+			return 0;
+	}
+
+	init_cols();
+	surplus = term_width-width;
+
+	return 1;
+}
+
+static int
+fits_across(void) {
+	size_t width;
+	size_t col, i;
+
+	width = (num_cols-1)*padding;
+	if (width > term_width)
+		return 0;
+
+	for (i = 0; i < num_cols; i++)
+		cols[i].width = 0;
+
+	col = 0;
+	for (i = 0; i < list_len; i++) {
+		if (list[i].width > cols[col].width) {
+			width += list[i].width-cols[col].width;
+			if (width > term_width)
+				return 0;
+
+			cols[col].width = list[i].width;
+		}
+
+		col++;
+		if (col >= num_cols)
+			col = 0;
+	}
+
+	surplus = term_width-width;
+
+	return 1;
+}
+
+/* Returns the width a layout with the given number of rows is estimated to
+ * take, counting each column as wide as the narrowest width exceeded by at
+ * most one in that many items. over[w] is the number of items wider than w. */
+static size_t
+estimate_width(size_t rows, const size_t *over, size_t max) {
+	size_t lo, hi, mid;
+	size_t cols, k;
+
+	cols = calc_from(rows);
+	if ((cols-1)*padding > term_width)
+		return SIZE_MAX;
+
+	k = list_len/rows;
+	lo = 0;
+	hi = max;
+	while (lo < hi) {
+		mid = lo+(hi-lo)/2;
+		if (over[mid] <= k)
+			hi = mid;
+		else
+			lo = mid+1;
+	}
+
+	if (lo > (term_width - (cols-1)*padding)/cols)
+		return SIZE_MAX;
+
+	return cols*lo + (cols-1)*padding;
+}
+
+/* Estimates the fewest rows, not less than lo, the list fits in from a
+ * histogram of item widths. */
+static size_t
+estimate_rows(size_t lo) {
+	size_t *over;
+	size_t hi, mid, max, n, x;
+	size_t i;
+
+	max = 0;
+	for (i = 0; i < list_len; i++)
+		max = MAX(max, list[i].width);
+
+	over = xmalloc((max+1)*sizeof over[0]);
+
+	for (i = 0; i <= max; i++)
+		over[i] = 0;
+
+	for (i = 0; i < list_len; i++)
+		over[list[i].width]++;
+
+	n = 0;
+	for (i = max+1; i-- > 0; ) {
+		x = over[i];
+		over[i] = n;
+		n += x;
+	}
+
+	hi = list_len;
+	while (lo < hi) {
+		mid = lo+(hi-lo)/2;
+		if (estimate_width(mid, over, max) <= term_width)
+			hi = mid;
+		else
+			lo = mid+1;
+	}
+
+	free(over);
+
+	return lo;
+}
+
+static int
+fits_rows(size_t rows) {
+	num_rows = rows;
+	num_cols = calc_from(rows);
+
+	return fits();
+}
+
+#define APPROX_TRIES 16
+
+/* Checks the estimate with a bounded number of fits() calls. Row counts past
+ * it are tried at doubling distances until one fits, and the gap between that
+ * and the last one that did not is then halved while tries are left. Since
+ * fitting is not monotonic in rows, the fewest rows giving one more column
+ * are tried last. For -I, the exact layout is searched for as well to tell how
+ * far off this one is. */
+static void
+calc_approximate(void) {
+	size_t lo, hi, mid, step, exact;
+	int tries;
+
+	lo = num_rows;
+	exact = lo;
+
+	if (info)
+		while (exact <= list_len && !fits_rows(exact))
+			exact++;
+
+	hi = estimate_rows(lo);
+
+	/* Items are no wider than the output, so a single column always fits,
+	 * and this ends by list_len rows at the latest. */
+	for (step = 1; !fits_rows(hi); step *= 2) {
+		lo = hi+1;
+		hi = list_len-hi > step ? hi+step : list_len;
+	}
+
+	for (tries = 0; lo < hi && tries < APPROX_TRIES; tries++) {
+		mid = lo+(hi-lo)/2;
+		if (fits_rows(mid))
+			hi = mid;
+		else
+			lo = mid+1;
+	}
+
+	for (tries = 0; tries < APPROX_TRIES; tries++) {
+		mid = calc_from(calc_from(hi) + 1);
+		if (mid >= hi || !fits_rows(mid))
+			break;
+
+		hi = mid;
+	}
+
+	if (num_rows != hi || num_cols != calc_from(hi))
+		fits_rows(hi);
+
+	if (info)
+		row_slack = hi-exact;
+}
+
+static void
+calc_sizes(void) {
+	init_calc();
+
+	if (table) {
+		init_cols_table();
+	}
+	else if (cols_fixed) {
+		if (across) {
+			num_rows = calc_from(num_cols);
+			init_cols_across();
+		}
+		else {
+			num_cols = calc_from(num_rows);
+			init_cols();
+		}
+	}
+	else if (approximate) {
+		calc_approximate();
+	}
+	else if (across) {
+		for (; num_cols >= 1; num_cols--) {
+			num_rows = calc_from(num_cols);
+			if (fits_across())
+				break;
+		}
+	}
+	else {
+		for (; num_rows <= list_len; num_rows++) {
+			num_cols = calc_from(num_rows);
+			if (fits())
+				break;
+		}
+	}
+}
+
+static void
+init_print(void) {
+	size_t i, j;
+	size_t step, first, last, next;
+
+	for (i = 0; i < num_cols; i++)
+		cols[i].right_aligned = 0;
+
+	for (i = 0; i < right_len; i++) {
+		step = right[i].step;
+
+		if (right[i].backward) {
+			if (right[i].first > num_cols)
+				continue;
+
+			last = num_cols-right[i].first + 1;
+
+			if (step == 0 || step >= last)
+				first = last;
+			else if (last%step)
+				first = last%step;
+			else
+				first = step;
+		}
+		else {
+			first = right[i].first;
+			last = num_cols;
+		}
+
+		for (j = first-1; j < last; j = next) {
+			cols[j].right_aligned = 1;
+
+			next = j+step;
+			if (next <= j)
+				break;
+		}
+	}
+}
+
+static size_t
+total_width(void) {
+	size_t i;
+	size_t width;
+
+	if (!cols_fixed)
+		return term_width;
+
+	width = (num_cols-1)*padding;
+	for (i = 0; i < num_cols; i++)
+		width += cols[i].width;
+
+	return width;
+}
+
+static void
+print_info(void) {
+	size_t i;
+
+	printf("%zu", list_len);
+	printf(" %zu", total_width());
+	printf(" %zu", num_rows);
+	printf(" %zu", num_cols);
+	printf(" %zu", surplus);
+
+	printf(" %zu", row_slack);
+
+	for (i = 0; i < num_cols; i++)
+		printf(" %zu", cols[i].width);
+
+	for (i = 0; i < num_cols; i++)
+		if (cols[i].right_aligned)
+			printf(" %zu", i+1);
+
+	putchar('\n');
+}
+
+/* Writes out the gathered output. Pages given to a pipe with vmsplice() are
+ * referenced rather than copied, so that is only done when nothing was copied
+ * to the staging buffer, which is reused, and the pieces are long enough to be
+ * worth it. */
+static void
+flush_gathered(void) {
+	struct iovec *v;
+	size_t n;
+	ssize_t x;
+
+	v = iov;
+	n = iov_len;
+
+	while (n > 0) {
+#if defined(__linux__)
+		if (splice_out && stage_len == 0 && iov_bytes/iov_len >= 4096)
+			x = vmsplice(1, v, MIN(n, IOV_MAX), 0);
+		else
+#endif
+			x = writev(1, v, MIN(n, IOV_MAX));
+
+		if (x == -1 && errno == EINTR)
+			continue;
+
+		if (x == -1 && splice_out) {
+			splice_out = 0;
+			continue;
+		}
+
+		if (x <= 0)
+			die("stdout");
+
+		for (; n > 0 && (size_t)x >= v->iov_len; v++, n--)
+			x -= v->iov_len;
+
+		if (n > 0) {
+			v->iov_base = (char *)v->iov_base + x;
+			v->iov_len -= x;
+		}
+	}
+
+	iov_len = 0;
+	iov_bytes = 0;
+	stage_len = 0;
+}
+
+/* Adds a piece of output. Short items are copied to the staging buffer so as
+ * not to need a piece each, and so are constant pieces following them. */
+static void
+add_gathered(const void *p, size_t n, int constant) {
+	struct iovec *v;
+	char *tail;
+
+	if (n == 0)
+		return;
+
+	v = iov_len > 0 ? &iov[iov_len-1] : NULL;
+	tail = &stage[stage_len];
+
+	if (n < 256 && (!constant || (v && (char *)v->iov_base+v->iov_len == tail))) {
+		if (stage_len+n > sizeof stage || iov_len == sizeof iov/sizeof iov[0]) {
+			flush_gathered();
+			v = NULL;
+			tail = stage;
+		}
+
+		memcpy(tail, p, n);
+		stage_len += n;
+		iov_bytes += n;
+
+		if (v && (char *)v->iov_base+v->iov_len == tail) {
+			v->iov_len += n;
+			return;
+		}
+
+		p = tail;
+	}
+	else {
+		if (iov_len == sizeof iov/sizeof iov[0])
+			flush_gathered();
+
+		iov_bytes += n;
+	}
+
+	iov[iov_len].iov_base = (void *)p;
+	iov[iov_len].iov_len = n;
+	iov_len++;
+}
+
+static void
+pad(size_t n) {
+	static const char spaces[] = {
+		' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+		' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+		' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+		' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '
+	};
+	static const wchar_t s[] = L"        ";
+	static const size_t slen = sizeof s/sizeof s[0] - 1;
+	size_t end, tabs;
+
+	/* With -e, padding that reaches past a tab stop is made of tabs up to
+	 * the last stop it reaches, unless that would replace a single
+	 * space. */
+	end = out_col+n;
+	tabs = 0;
+
+	if (tab_size > 0 && end - end%tab_size >= out_col+2) {
+		tabs = (end - end%tab_size - (out_col - out_col%tab_size))/tab_size;
+		n = end%tab_size;
+	}
+
+	out_col = end;
+
+	if (measuring) {
+		out_off += tabs+n;
+		return;
+	}
+
+	if (gather) {
+		for (; tabs > 0; tabs--)
+			add_gathered("\t", 1, 1);
+
+		for (; n > sizeof spaces; n -= sizeof spaces)
+			add_gathered(spaces, sizeof spaces, 1);
+
+		add_gathered(spaces, n, 1);
+		return;
+	}
+
+	if (bytes || map) {
+		for (; tabs > 0; tabs--)
+			putchar('\t');
+
+		for (; n > 0; n--)
+			putchar(' ');
+
+		return;
+	}
+
+	for (; tabs > 0; tabs--)
+		putwchar(L'\t');
+
+	for (; n > slen; n -= slen)
+		fputws(s, stdout);
+
+	fputws(&s[slen-n], stdout);
+}
+
+static void
+newline(void) {
+	out_col = 0;
+
+	if (measuring)
+		out_off++;
+	else if (gather)
+		add_gathered("\n", 1, 1);
+	else if (bytes || map)
+		putchar('\n');
+	else
+		putwchar(L'\n');
+}
+
+static size_t
+text_bytes(const struct item *p) {
+	char s[MB_LEN_MAX];
+	mbstate_t ps;
+	size_t i, n, x;
+
+	if (bytes || map)
+		return p->len;
+
+	memset(&ps, 0, sizeof ps);
+
+	n = 0;
+	for (i = 0; i < p->len; i++)
+		if ((x = wcrtomb(s, p->text[i], &ps)) != (size_t)-1)
+			n += x;
+
+	return n;
+}
+
+static void
+print_item(size_t k, size_t col, size_t space) {
+	const struct item *p;
+	size_t empty;
+	size_t i;
+
+	p = intern ? &values[ids[k]] : &list[k];
+
+	empty = cols[col].width - p->width;
+	if (cols[col].right_aligned)
+		pad(empty);
+	else
+		space += empty;
+
+	if (measuring) {
+		item_offs[k] = out_off;
+		out_off += text_bytes(p);
+	}
+	else if (gather)
+		add_gathered(&map[offs[k]], p->len, 0);
+	else if (map)
+		fwrite(&map[offs[k]], 1, p->len, stdout);
+	else if (bytes)
+		for (i = 0; i < p->len; i++)
+			putchar(p->text[i]);
+	else if (nuls)
+		for (i = 0; i < p->len; i++)
+			putwchar(p->text[i]);
+	else
+		fputws(p->text, stdout);
+
+	out_col += p->width;
+	pad(space);
+}
+
+static void
+print_cell(size_t row, size_t col, size_t space) {
+	size_t i;
+
+	if (across)
+		i = row*num_cols + col;
+	else
+		i = col*num_rows + row;
+
+	if (i >= list_len)
+		pad(cols[col].width+space);
+	else
+		print_item(i, col, space);
+}
+
+static void
+print_table(size_t first, size_t end) {
+	size_t row, col, i;
+
+	i = first > 0 ? rows[first-1].last+1 : 0;
+	for (row = first; row < end; row++) {
+		col = 0;
+		for (; i < rows[row].last; i++) {
+			print_item(i, col, padding);
+			col++;
+		}
+
+		print_item(i, col, cols[col].rest);
+		newline();
+
+		i++;
+	}
+}
+
+static void
+print_rows(size_t first, size_t end) {
+	size_t i, j;
+
+	for (i = first; i < end; i++) {
+		for (j = 0; j < num_cols-1; j++)
+			print_cell(i, j, padding);
+
+		print_cell(i, j, surplus);
+		newline();
+	}
+}
+
+/* Prints the layout as JSON Lines: a line describing the output and its
+ * columns, followed by a line for each item giving its row and column, the
+ * byte offset of its text in the output, and its width. The offsets are found
+ * by running the printing code without printing anything. */
+static void
+print_layout(void) {
+	size_t i, row, col;
+
+	item_offs = xmalloc(list_len*sizeof item_offs[0]);
+
+	measuring = 1;
+	if (table)
+		print_table(0, num_rows);
+	else
+		print_rows(0, num_rows);
+
+	measuring = 0;
+
+	printf("{\"items\":%zu", list_len);
+	printf(",\"width\":%zu", total_width());
+	printf(",\"rows\":%zu", num_rows);
+	printf(",\"columns\":%zu", num_cols);
+	printf(",\"surplus\":%zu", surplus);
+	printf(",\"bytes\":%zu", out_off);
+
+	printf(",\"widths\":[");
+	for (i = 0; i < num_cols; i++)
+		printf(i ? ",%zu" : "%zu", cols[i].width);
+
+	printf("],\"right\":[");
+	for (i = 0; i < num_cols; i++)
+		printf(i ? ",%s" : "%s", cols[i].right_aligned ? "true" : "false");
+
+	puts("]}");
+
+	row = 0;
+	col = 0;
+	for (i = 0; i < list_len; i++) {
+		if (!table) {
+			row = across ? i/num_cols : i%num_rows;
+			col = across ? i%num_cols : i/num_rows;
+		}
+
+		printf("{\"row\":%zu,\"column\":%zu", row, col);
+		printf(",\"offset\":%zu,\"width\":%zu}\n", item_offs[i],
+			intern ? values[ids[i]].width : list[i].width);
+
+		if (table && i == rows[row].last) {
+			row++;
+			col = 0;
+		}
+		else if (table) {
+			col++;
+		}
+	}
+
+	free(item_offs);
+}
+
+/* Prints rows of mapped items without copying them: the output is gathered
+ * as pieces of the mapping and of a constant run of spaces, and written with
+ * writev(), or spliced into the output if it is a pipe. */
+static void
+print_gathered(size_t first, size_t end) {
+	struct stat st;
+
+	fflush(stdout);
+	splice_out = fstat(1, &st) == 0 && S_ISFIFO(st.st_mode);
+
+	gather = 1;
+	print_rows(first, end);
+	flush_gathered();
+	gather = 0;
+}
+
+/* Only the rows selected with -l are printed, but the layout is that of the
+ * whole list. */
+static void
+print_cols(void) {
+	size_t first, end;
+
+	init_print();
+
+	first = MIN(first_row, num_rows);
+	end = first + MIN(row_count, num_rows-first);
+
+	if (info)
+		print_info();
+	else if (layout)
+		print_layout();
+	else if (table)
+		print_table(first, end);
+	else if (map)
+		print_gathered(first, end);
+	else
+		print_rows(first, end);
+}
+
+/* Truncates an item parsed with a greater width to fit in term_width. */
+static void
+shrink_item(struct item *p) {
+	size_t begin, end, len, width;
+	size_t i, j, n;
+	int x;
+
+	status = 1;
+
+	if (map) {
+		measure_mapped(offs[p-list], offs[p-list] + p->len, p);
+		return;
+	}
+
+	begin = p->text-buf;
+	end = begin+p->len;
+	len = 0;
+	width = 0;
+
+	for (i = begin; i < end; i++) {
+		if (colors && (j = skip_color(i)) != i) {
+			len += j-i + 1;
+			i = j;
+			continue;
+		}
+
+		n = measure_cluster(i, end-i, &x);
+		if (width+x > term_width)
+			break;
+
+		len += n;
+		width += x;
+		i += n-1;
+	}
+
+	p->len = len;
+	p->width = width;
+
+	if (!nuls)
+		buf[begin+len] = L'\0';
+}
+
+static void
+print_label(size_t width) {
+	if (bytes || map)
+		printf("%zu:\n", width);
+	else
+		wprintf(L"%zu:\n", width);
+}
+
+/* Lays out and prints the list once for each width, widest first. A layout
+ * that fits in a width also fits in a greater one, so unless items had to be
+ * truncated for it, the layout found for a width bounds the search for the
+ * next: down, it needs at least as many rows, and across, at most as many
+ * columns. Truncated items are sorted again, since their order can change. */
+static void
+columnate(int *first) {
+	size_t i, j;
+	int shrunk;
+
+	if (widths_len < 2 || cols_fixed) {
+		calc_sizes();
+
+		if (!*first && !info && !layout)
+			newline();
+
+		print_cols();
+		*first = 0;
+
+		return;
+	}
+
+	for (i = 0; i < widths_len; i++) {
+		term_width = widths[i];
+		shrunk = 0;
+
+		for (j = 0; j < list_len; j++)
+			if (list[j].width > term_width) {
+				shrink_item(&list[j]);
+				shrunk = 1;
+			}
+
+		if (shrunk) {
+			min_rows = 0;
+			max_across = SIZE_MAX;
+
+			if (order)
+				sort_list();
+		}
+
+		calc_sizes();
+
+		if (!layout) {
+			if (!*first)
+				newline();
+
+			print_label(term_width);
+		}
+
+		print_cols();
+		*first = 0;
+
+		min_rows = num_rows;
+		max_across = num_cols;
+	}
+
+	term_width = widths[0];
+	min_rows = 0;
+	max_across = SIZE_MAX;
+}
+
+/* Makes the buffers used for a list ready for the next one. */
+static void
+reset_list(size_t fixed_cols) {
+	size_t i;
+
+	list_len = 0;
+	values_len = 0;
+	num_rows = 0;
+	num_cols = fixed_cols;
+	surplus = 0;
+
+	for (i = 0; i < seen_alloc; i++)
+		seen[i] = SIZE_MAX;
+}
+
+/* Hashes the bytes at src into two independent hashes: h[0] names the cache
+ * entry, and h[1] is stored in it to tell entries whose names collide. */
+static void
+hash_bytes(uint64_t h[2], const void *src, size_t n) {
+	const unsigned char *p;
+	size_t i;
+
+	p = src;
+	for (i = 0; i < n; i++) {
+		h[0] ^= p[i];
+		h[0] *= UINT64_C(1099511628211);
+		h[1] = (h[1] ^ p[i]) * UINT64_C(0x9e3779b97f4a7c15);
+		h[1] ^= h[1] >> 29;
+	}
+}
+
+/* The cache is keyed by the input, the arguments, the width of the terminal,
+ * and the locale; that is, everything the output depends on. An entry is a
+ * file holding a header with the exit status, the size of the input and a
+ * second hash of the key, followed by the output. */
+static void
+replay_cache(void) {
+	uint64_t h[2], len;
+	const char *s;
+	int i, fd;
+	struct stat st;
+	const unsigned char *p;
+
+	if (order == 'c' && !bytes)
+		setlocale(LC_COLLATE, "");
+
+	h[0] = UINT64_C(14695981039346656037);
+	h[1] = 0;
+	hash_bytes(h, buf, buf_len*sizeof buf[0]);
+
+	for (i = 1; i < arg_count; i++)
+		hash_bytes(h, args[i], strlen(args[i])+1);
+
+	hash_bytes(h, &term_width, sizeof term_width);
+	hash_bytes(h, &tab_size, sizeof tab_size);
+	s = setlocale(LC_ALL, NULL);
+	hash_bytes(h, s, strlen(s)+1);
+
+	cache_path = xmalloc(strlen(cache_dir) + 32);
+	sprintf(cache_path, "%s/%016" PRIx64, cache_dir, h[0]);
+
+	memcpy(cache_head, "nat", 4);
+	len = buf_len;
+	memcpy(&cache_head[5], &len, sizeof len);
+	memcpy(&cache_head[13], &h[1], sizeof h[1]);
+
+	fd = open(cache_path, O_RDONLY);
+	if (fd == -1)
+		return;
+
+	if (fstat(fd, &st) == 0 && st.st_size >= CACHE_HEAD
+			&& (uintmax_t)st.st_size <= SIZE_MAX) {
+		p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED && !memcmp(p, cache_head, 4)
+				&& !memcmp(p+5, &cache_head[5], CACHE_HEAD-5)) {
+			if (!write_full(1, p+CACHE_HEAD, st.st_size-CACHE_HEAD))
+				die("stdout");
+
+			exit(p[4]);
+		}
+	}
+
+	close(fd);
+}
+
+/* Opens a file in memory, which writes to cannot fail for lack of space. */
+static int
+open_buffer(void) {
+#if defined(__linux__)
+	return memfd_create("nat", 0);
+#else
+	char name[32];
+	int fd;
+
+	sprintf(name, "/nat.%ld", (long)getpid());
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd != -1)
+		shm_unlink(name);
+
+	return fd;
+#endif
+}
+
+/* Redirects the standard output to a file in memory, from which the output is
+ * written out once complete, and then copied to a new cache entry. If the
+ * file cannot be created, the output is not cached. */
+static void
+start_capture(void) {
+	int fd;
+
+	fd = open_buffer();
+	if (fd == -1)
+		return;
+
+	fflush(stdout);
+	if ((cache_out = dup(1)) == -1 || dup2(fd, 1) == -1) {
+		if (cache_out != -1)
+			close(cache_out);
+
+		cache_out = -1;
+	}
+
+	close(fd);
+}
+
+/* Writes the output out, and copies it to a new entry, which is put in place
+ * once complete. Since rename() is atomic, concurrent runs never see a partial
+ * entry. If the entry cannot be written, the output is not cached. */
+static void
+finish_capture(void) {
+	struct stat st;
+	const char *p;
+	int ok, fd;
+
+	ok = fflush(stdout) != EOF && fstat(1, &st) != -1
+		&& (uintmax_t)st.st_size <= SIZE_MAX;
+
+	p = NULL;
+	if (ok && st.st_size > 0) {
+		p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, 1, 0);
+		ok = p != MAP_FAILED;
+	}
+
+	dup2(cache_out, 1);
+	close(cache_out);
+	cache_out = -1;
+
+	if (!ok || (st.st_size > 0 && !write_full(1, p, st.st_size)))
+		die("stdout");
+
+	cache_temp = xmalloc(strlen(cache_path) + 8);
+	sprintf(cache_temp, "%s.XXXXXX", cache_path);
+
+	fd = mkstemp(cache_temp);
+	if (fd == -1)
+		return;
+
+	cache_head[4] = status;
+	if (!write_full(fd, cache_head, CACHE_HEAD)
+			|| (st.st_size > 0 && !write_full(fd, p, st.st_size))
+			|| close(fd) == -1 || rename(cache_temp, cache_path) == -1)
+		unlink(cache_temp);
+}
+
+/* Lays the list out again after items from old_len on have been appended,
+ * and prints the rows that changed, preceded by a line giving the number of
+ * the first of them and the number of rows. Appending items never makes a
+ * layout that did not fit fit, so the search starts from the previous one:
+ * down, at as many rows, and across, at as many columns unless all items
+ * were on a single row. */
+static void
+extend_layout(size_t old_len, size_t fixed_cols) {
+	size_t rows_before, cols_before, surplus_before;
+	size_t first, i;
+	int changed;
+
+	rows_before = num_rows;
+	cols_before = num_cols;
+	surplus_before = surplus;
+
+	if (old_len > 0) {
+		prev_widths = xrealloc(prev_widths,
+		    cols_before*sizeof prev_widths[0]);
+
+		for (i = 0; i < cols_before; i++)
+			prev_widths[i] = cols[i].width;
+
+		if (!cols_fixed) {
+			min_rows = num_rows;
+			max_across = num_cols < old_len ? num_cols : SIZE_MAX;
+		}
+	}
+
+	if (cols_fixed)
+		num_cols = fixed_cols;
+
+	calc_sizes();
+
+	changed = old_len == 0 || num_cols != cols_before
+	    || surplus != surplus_before || (!across && num_rows != rows_before);
+
+	for (i = 0; !changed && i < num_cols; i++)
+		if (cols[i].width != prev_widths[i])
+			changed = 1;
+
+	if (changed)
+		first = 0;
+	else if (across)
+		first = old_len/num_cols;
+	else if (list_len-old_len >= num_rows - old_len%num_rows)
+		first = 0;
+	else
+		first = old_len%num_rows;
+
+	if (bytes)
+		printf("%zu %zu\n", first+1, num_rows);
+	else
+		wprintf(L"%zu %zu\n", first+1, num_rows);
+
+	init_print();
+	print_rows(first, num_rows);
+	fflush(stdout);
+}
+
+/* In incremental mode, groups of items separated by empty items are appended
+ * to the list one by one, and the layout is updated after each. */
+static void
+run_incremental(void) {
+	size_t fixed_cols, old_len;
+	int more;
+
+	fixed_cols = num_cols;
+	list = xmalloc(list_alloc*sizeof list[0]);
+
+	do {
+		more = slurp_group();
+
+		if (!more) {
+			if (buf_len == next_list)
+				break;
+
+			reserve(delim_len);
+			fix_eof();
+		}
+
+		if (!nuls && (delim_len > 1 || delim != L'\0'))
+			nuls = wmemchr(&buf[next_list], L'\0', buf_len-next_list) != NULL;
+
+		old_len = list_len;
+		parse_list();
+
+		if (list_len > old_len)
+			extend_layout(old_len, fixed_cols);
+	} while (more);
+
+	exit(status);
+}
+
+/* In paged mode, each page is columnated and printed as soon as it has been
+ * read, and its buffers are reused for the next. */
+static void
+run(void) {
+	size_t fixed_cols;
+	size_t end, len;
+	int first;
+
+	fixed_cols = num_cols;
+	first = 1;
+
+	select_parser();
+
+	if (grow)
+		run_incremental();
+
+	if (page_size) {
+		while ((end = slurp_page()) > 0) {
+			len = buf_len;
+			buf_len = end;
+
+			init_parse();
+			parse_list();
+
+			if (list_len > 0) {
+				if (order)
+					sort_list();
+
+				first = 1;
+				columnate(&first);
+				fflush(stdout);
+			}
+
+			reset_list(fixed_cols);
+
+			wmemmove(buf, &buf[end], len-end);
+			buf_len = len-end;
+		}
+
+		exit(status);
+	}
+
+	if (records) {
+		load_records();
+		parse_records();
+		if (list_len > 0)
+			columnate(&first);
+
+		exit(status);
+	}
 
-	return list[i].width;
-}
+	if (mapped && map_input()) {
+		parse_map();
+		if (list_len > 0)
+			columnate(&first);
 
-static void
-init_cols(void) {
-	size_t i;
+		exit(status);
+	}
 
-	for (i = 0; i < num_cols; i++)
-		cols[i].width = max_width(i);
-}
+	if (pipelined && slurp_pipelined()) {
+		if (list_len > 0) {
+			if (order)
+				sort_list();
 
-static void
-init_cols_across(void) {
-	size_t col, i;
+			columnate(&first);
+		}
 
-	for (i = 0; i < num_cols; i++)
-		cols[i].width = list[i].width;
+		exit(status);
+	}
 
-	col = 0;
-	for (; i < list_len; i++) {
-		if (list[i].width > cols[col].width)
-			cols[col].width = list[i].width;
+	slurp_input();
 
-		col++;
-		if (col >= num_cols)
-			col = 0;
+	if (cache_dir) {
+		replay_cache();
+		start_capture();
 	}
-}
 
-static void
-init_cols_table(void) {
-	size_t row, col, i;
+	init_parse();
 
-	for (i = 0; i < num_cols; i++)
-		cols[i].width = 0;
+	while (next_list < buf_len) {
+		parse_list();
+		if (list_len == 0)
+			continue;
 
-	i = 0;
-	for (row = 0; row < num_rows; row++) {
-		for (col = 0; i <= rows[row].last; col++) {
-			if (list[i].width > cols[col].width)
-				cols[col].width = list[i].width;
+		if (order)
+			sort_list();
 
-			i++;
-		}
+		columnate(&first);
+		reset_list(fixed_cols);
 	}
+
+	if (cache_out != -1)
+		finish_capture();
+
+	exit(status);
 }
 
 static int
-fits(void) {
-	size_t width;
-	size_t i;
+read_full(int fd, void *dst, size_t n) {
+	char *p;
+	ssize_t x;
+
+	for (p = dst; n > 0; p += x, n -= x) {
+		x = read(fd, p, n);
+		if (x == -1 && errno == EINTR)
+			x = 0;
+		else if (x <= 0)
+			return 0;
+	}
 
-	width = (num_cols-1)*padding;
-	if (width > term_width)
-		return 0;
+	return 1;
+}
 
-	for (i = 0; i < num_cols; i++) {
-		width += max_width(i);
-		if (width > term_width)
+static int
+write_full(int fd, const void *src, size_t n) {
+	const char *p;
+	ssize_t x;
+
+	for (p = src; n > 0; p += x, n -= x) {
+		x = write(fd, p, n);
+		if (x == -1 && errno == EINTR)
+			x = 0;
+		else if (x <= 0)
 			return 0;
 	}
 
-	init_cols();
-	surplus = term_width-width;
-
 	return 1;
 }
 
 static int
-fits_across(void) {
-	size_t width;
-	size_t col, i;
+open_socket(const char *path, struct sockaddr_un *sa) {
+	if (strlen(path) >= sizeof sa->sun_path) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
 
-	width = (num_cols-1)*padding;
-	if (width > term_width)
-		return 0;
+	memset(sa, 0, sizeof *sa);
+	sa->sun_family = AF_UNIX;
+	strcpy(sa->sun_path, path);
 
-	for (i = 0; i < num_cols; i++)
-		cols[i].width = 0;
+	return socket(AF_UNIX, SOCK_STREAM, 0);
+}
 
-	col = 0;
-	for (i = 0; i < list_len; i++) {
-		if (list[i].width > cols[col].width) {
-			width += list[i].width-cols[col].width;
-			if (width > term_width)
-				return 0;
+/* Returns the name of the locale LC_CTYPE is to be set from. */
+static const char *
+ctype_name(void) {
+	const char *s;
 
-			cols[col].width = list[i].width;
-		}
+	if (!(s = getenv("LC_ALL")) || *s == '\0')
+		if (!(s = getenv("LC_CTYPE")) || *s == '\0')
+			s = getenv("LANG");
 
-		col++;
-		if (col >= num_cols)
-			col = 0;
-	}
+	return s ? s : "";
+}
 
-	surplus = term_width-width;
+/* Only LC_CTYPE matters for columnating, so other categories are not loaded,
+ * and in the C locale, which would not need loading at all, input is read as
+ * plain bytes instead of through the wide character functions. */
+static void
+init_locale(void) {
+	const char *s;
 
-	return 1;
+	s = ctype_name();
+	if (*s == '\0' || !strcmp(s, "C") || !strcmp(s, "POSIX"))
+		bytes = 1;
+	else
+		setlocale(LC_CTYPE, "");
 }
 
+/* The environment variables that affect columnating, which requests carry. */
+static const char *const forwarded[] = {
+	"COLUMNS", "TABSIZE", "LC_ALL", "LC_CTYPE", "LANG"
+};
+
+/* A request is the length of its body, sent along with the client's standard
+ * streams, followed by the body; which consists of NUL-terminated strings: the
+ * forwarded variables that are set, in the form name=value, an empty string,
+ * and the arguments. The server replies with the exit status of the request in
+ * a single byte. */
 static void
-calc_sizes(void) {
-	init_calc();
+call_server(const char *path, int argc, char *argv[]) {
+	struct sockaddr_un sa;
+	int fd, fds[3];
+	const char *env;
+	char *body, *p;
+	size_t len, j;
+	int i;
+	unsigned char reply;
+	struct iovec iov;
+	struct msghdr msg;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof fds)];
+	} ctl;
+	struct cmsghdr *cmsg;
+
+	if ((fd = open_socket(path, &sa)) == -1)
+		return;
 
-	if (table) {
-		init_cols_table();
-	}
-	else if (cols_fixed) {
-		if (across) {
-			num_rows = calc_from(num_cols);
-			init_cols_across();
-		}
-		else {
-			num_cols = calc_from(num_rows);
-			init_cols();
-		}
-	}
-	else if (across) {
-		for (; num_cols >= 1; num_cols--) {
-			num_rows = calc_from(num_cols);
-			if (fits_across())
-				break;
-		}
-	}
-	else {
-		for (; num_rows <= list_len; num_rows++) {
-			num_cols = calc_from(num_rows);
-			if (fits())
-				break;
-		}
+	if (connect(fd, (struct sockaddr *)&sa, sizeof sa) == -1) {
+		close(fd);
+		return;
 	}
-}
 
-static void
-init_print(void) {
-	size_t i, j;
-	size_t step, first, last, next;
+	len = 1;
+	for (j = 0; j < sizeof forwarded/sizeof forwarded[0]; j++)
+		if ((env = getenv(forwarded[j])))
+			len += strlen(forwarded[j]) + strlen(env) + 2;
 
-	for (i = 0; i < num_cols; i++)
-		cols[i].right_aligned = 0;
+	for (i = 1; i < argc; i++)
+		len += strlen(argv[i]) + 1;
 
-	for (i = 0; i < right_len; i++) {
-		step = right[i].step;
+	body = xmalloc(len);
 
-		if (right[i].backward) {
-			if (right[i].first > num_cols)
-				continue;
+	p = body;
+	for (j = 0; j < sizeof forwarded/sizeof forwarded[0]; j++)
+		if ((env = getenv(forwarded[j])))
+			p += sprintf(p, "%s=%s", forwarded[j], env) + 1;
 
-			last = num_cols-right[i].first + 1;
+	*p++ = '\0';
 
-			if (step == 0 || step >= last)
-				first = last;
-			else if (last%step)
-				first = last%step;
-			else
-				first = step;
-		}
-		else {
-			first = right[i].first;
-			last = num_cols;
-		}
+	for (i = 1; i < argc; i++) {
+		strcpy(p, argv[i]);
+		p += strlen(p) + 1;
+	}
 
-		for (j = first-1; j < last; j = next) {
-			cols[j].right_aligned = 1;
+	for (i = 0; i < 3; i++)
+		fds[i] = i;
 
-			next = j+step;
-			if (next <= j)
-				break;
-		}
+	iov.iov_base = &len;
+	iov.iov_len = sizeof len;
+
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof ctl.buf;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof fds);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof fds);
+
+	if (sendmsg(fd, &msg, 0) != sizeof len || !write_full(fd, body, len)) {
+		close(fd);
+		free(body);
+		return;
+	}
+
+	if (!read_full(fd, &reply, 1)) {
+		errno = ECONNRESET;
+		die(path);
 	}
+
+	exit(reply);
 }
 
-static void
-print_info(void) {
-	size_t i;
-	size_t width;
+/* Tells if s is the assignment of a forwarded variable. */
+static int
+is_forwarded(const char *s) {
+	size_t j, n;
 
-	if (cols_fixed) {
-		width = (num_cols-1)*padding;
-		for (i = 0; i < num_cols; i++)
-			width += cols[i].width;
+	for (j = 0; j < sizeof forwarded/sizeof forwarded[0]; j++) {
+		n = strlen(forwarded[j]);
+		if (!strncmp(s, forwarded[j], n) && s[n] == '=')
+			return 1;
 	}
-	else {
-		width = term_width;
+
+	return 0;
+}
+
+/* Runs the request on fd in this process, which is a child of the server; the
+ * server replies with the exit status once it exits. */
+static void
+serve_client(int fd) {
+	int fds[3];
+	size_t len, j;
+	long max;
+	char *body, *p, *vars, *end;
+	char **args;
+	int i, n;
+	struct iovec iov;
+	struct msghdr msg;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof fds)];
+	} ctl;
+	struct cmsghdr *cmsg;
+
+	iov.iov_base = &len;
+	iov.iov_len = sizeof len;
+
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof ctl.buf;
+
+	if (recvmsg(fd, &msg, 0) != sizeof len)
+		_exit(2);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS
+			|| cmsg->cmsg_len != CMSG_LEN(sizeof fds))
+		_exit(2);
+
+	memcpy(fds, CMSG_DATA(cmsg), sizeof fds);
+
+	max = sysconf(_SC_ARG_MAX);
+	if (len == 0 || len > (max > 0 ? (size_t)max : 4096))
+		_exit(2);
+
+	body = xmalloc(len+1);
+	if (!read_full(fd, body, len))
+		_exit(2);
+
+	close(fd);
+
+	body[len] = '\0';
+	end = body+len;
+
+	vars = body;
+	for (p = body; p < end && *p; p += strlen(p) + 1)
+		if (!is_forwarded(p))
+			_exit(2);
+
+	if (p >= end)
+		_exit(2);
+
+	n = 1;
+	for (p++; p < end; p += strlen(p) + 1)
+		n++;
+
+	args = xmalloc((n+1)*sizeof args[0]);
+	args[0] = "nat";
+
+	i = 1;
+	for (p = vars; *p; p += strlen(p) + 1)
+		;
+
+	for (p++; p < end; p += strlen(p) + 1)
+		args[i++] = p;
+
+	args[i] = NULL;
+
+	for (i = 0; i < 3; i++) {
+		dup2(fds[i], i);
+		close(fds[i]);
 	}
 
-	printf("%zu", list_len);
-	printf(" %zu", width);
-	printf(" %zu", num_rows);
-	printf(" %zu", num_cols);
-	printf(" %zu", surplus);
+	for (j = 0; j < sizeof forwarded/sizeof forwarded[0]; j++)
+		unsetenv(forwarded[j]);
 
-	for (i = 0; i < num_cols; i++)
-		printf(" %zu", cols[i].width);
+	for (p = vars; *p; p += strlen(p) + 1)
+		putenv(p);
 
-	for (i = 0; i < num_cols; i++)
-		if (cols[i].right_aligned)
-			printf(" %zu", i+1);
+	if (strcmp(ctype_name(), loaded_ctype)) {
+		bytes = 0;
+		setlocale(LC_CTYPE, "C");
+		init_locale();
+	}
 
-	putchar('\n');
+	term_width = 80;
+	set_defaults();
+	sock_path = NULL;
+	optind = 1;
+	parse_args(n, args);
+
+	/* The cache would be written with the credentials of the server. */
+	if (sock_path || cache_dir)
+		usage_error();
+
+	run();
 }
 
-static void
-pad(size_t n) {
-	static const wchar_t s[] = L"        ";
-	static const size_t slen = sizeof s/sizeof s[0] - 1;
+struct client {
+	pid_t pid;
+	int fd;
+};
 
-	for (; n > slen; n -= slen)
-		fputws(s, stdout);
+static struct client *clients;
+static size_t clients_len;
+static size_t clients_alloc;
 
-	fputws(&s[slen-n], stdout);
+static void
+wake(int sig) {
+	(void)sig;
 }
 
+/* Replies to the clients whose requests have been served. */
 static void
-print_item(const struct item *restrict p, size_t col, size_t space) {
-	size_t empty;
+reap_clients(void) {
+	pid_t pid;
 	size_t i;
+	int st;
+	unsigned char reply;
 
-	empty = cols[col].width - p->width;
-	if (cols[col].right_aligned)
-		pad(empty);
-	else
-		space += empty;
+	while ((pid = waitpid(-1, &st, WNOHANG)) > 0) {
+		for (i = 0; i < clients_len; i++)
+			if (clients[i].pid == pid)
+				break;
 
-	if (nuls)
-		for (i = 0; i < p->len; i++)
-			putwchar(p->text[i]);
-	else
-		fputws(p->text, stdout);
+		if (i == clients_len)
+			continue;
 
-	pad(space);
+		reply = WIFEXITED(st) ? WEXITSTATUS(st) : 2;
+		write_full(clients[i].fd, &reply, 1);
+		close(clients[i].fd);
+		clients[i] = clients[--clients_len];
+	}
 }
 
+/* Each connection is handled in a child of the server, so clients are served
+ * concurrently. The only work saved across requests is that of loading the
+ * locale, which those using the locale of the server do not pay for again;
+ * everything else is allocated and computed anew for each. The server waits
+ * for connections and for children to exit at once, with SIGCHLD blocked
+ * until it waits, so that no exit goes unnoticed. */
 static void
-print_cell(size_t row, size_t col, size_t space) {
+serve(void) {
+	struct sockaddr_un sa;
+	struct stat st;
+	struct sigaction act;
+	struct timespec nap;
+	sigset_t mask, old;
+	fd_set fds;
+	int sfd, fd;
+	pid_t pid;
 	size_t i;
 
-	if (across)
-		i = row*num_cols + col;
-	else
-		i = col*num_rows + row;
+	if ((sfd = open_socket(sock_path, &sa)) == -1)
+		die(sock_path);
 
-	if (i >= list_len)
-		pad(cols[col].width+space);
-	else
-		print_item(&list[i], col, space);
-}
+	if (lstat(sock_path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(sock_path);
 
-static void
-print_table(void) {
-	size_t row, col, i, j;
-	size_t empty;
+	if (bind(sfd, (struct sockaddr *)&sa, sizeof sa) == -1
+			|| listen(sfd, SOMAXCONN) == -1)
+		die(sock_path);
 
-	i = 0;
-	for (row = 0; row < num_rows; row++) {
-		col = 0;
-		for (; i < rows[row].last; i++) {
-			print_item(&list[i], col, padding);
-			col++;
-		}
+	/* A client that went away must not take the server with it. */
+	signal(SIGPIPE, SIG_IGN);
 
-		empty = 0;
-		for (j = col+1; j < num_cols; j++)
-			empty += padding+cols[j].width;
+	memset(&act, 0, sizeof act);
+	act.sa_handler = wake;
+	sigemptyset(&act.sa_mask);
+	sigaction(SIGCHLD, &act, NULL);
 
-		print_item(&list[i], col, empty);
-		putwchar(L'\n');
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &old);
 
-		i++;
-	}
-}
+	nap.tv_sec = 0;
+	nap.tv_nsec = 100000000;
 
-static void
-print_cols(void) {
-	size_t i, j;
+	for (;;) {
+		reap_clients();
 
-	init_print();
+		FD_ZERO(&fds);
+		FD_SET(sfd, &fds);
+		if (pselect(sfd+1, &fds, NULL, NULL, NULL, &old) == -1)
+			continue;
 
-	if (info) {
-		print_info();
-	}
-	else if (table) {
-		print_table();
-	}
-	else {
-		for (i = 0; i < num_rows; i++) {
-			for (j = 0; j < num_cols-1; j++)
-				print_cell(i, j, padding);
+		fd = accept(sfd, NULL, NULL);
+		if (fd == -1) {
+			if (errno == EBADF || errno == EINVAL || errno == ENOTSOCK)
+				die("accept");
+
+			/* Out of descriptors or memory, until a request is
+			 * served or a moment has passed. */
+			if (errno == EMFILE || errno == ENFILE
+					|| errno == ENOBUFS || errno == ENOMEM)
+				pselect(0, NULL, NULL, NULL, &nap, &old);
+
+			continue;
+		}
+
+		if (clients_len == clients_alloc) {
+			clients_alloc = clients_alloc ? 2*clients_alloc : 16;
+			clients = xrealloc(clients,
+				clients_alloc*sizeof clients[0]);
+		}
 
-			print_cell(i, j, surplus);
-			putwchar(L'\n');
+		pid = fork();
+		if (pid == 0) {
+			sigprocmask(SIG_SETMASK, &old, NULL);
+			signal(SIGCHLD, SIG_DFL);
+			signal(SIGPIPE, SIG_DFL);
+			close(sfd);
+
+			for (i = 0; i < clients_len; i++)
+				close(clients[i].fd);
+
+			serve_client(fd);
+		}
+		else if (pid == -1) {
+			perror("fork");
+			close(fd);
+		}
+		else {
+			clients[clients_len].pid = pid;
+			clients[clients_len].fd = fd;
+			clients_len++;
 		}
 	}
 }
 
 int
 main(int argc, char *argv[]) {
-	setlocale(LC_ALL, "");
+	const char *env;
+
+	if ((env = getenv("NAT_SOCKET")) && *env)
+		call_server(env, argc, argv);
+
+	init_locale();
 	set_defaults();
 	parse_args(argc, argv);
-	slurp_input();
-	parse_list();
-	calc_sizes();
-	print_cols();
+
+	if (sock_path) {
+		loaded_ctype = strdup(ctype_name());
+		serve();
+	}
+
+	run();
 	return status;
 }
 
 static void
 die(const char *s) {
+	int saved;
+
+	saved = errno;
+	setlocale(LC_MESSAGES, "");
+	errno = saved;
 	perror(s);
 	exit(2);
 }
@@ -1065,6 +4273,11 @@ static int
 xwcwidth(wchar_t c) {
 	int x;
 
+	if (c < 0x7f)
+		return c >= 0x20;
+	else if (bytes)
+		return 0;
+
 	x = wcwidth(c);
 	if (x == -1)
 		return 0;
@@ -0,0 +1,195 @@
+# Copyright 2023, 2024 Oğuz İsmail Uysal <oguzismailuysal@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+# {{{
+now() {
+	date +%s%N
+}
+
+run_bench() {
+	printf 'measuring %s... ' "$*"
+
+	i=0
+	start=$(now)
+
+	while test $i -lt $iterations; do
+		eval "$environment $program $arguments" <$input >/dev/null
+		i=$((i+1))
+	done
+
+	end=$(now)
+
+	echo "$(((end-start)/iterations/1000)) us per run"
+}
+
+measure_size() {
+	printf 'measuring the output size of %s... ' "$*"
+	echo "$(eval "$environment $program $arguments" <$input | wc -c) bytes"
+}
+# }}}
+
+program=./nat
+unset COLUMNS
+
+tmp=${TMPDIR:-/tmp}/nat_bench.$$
+trap 'rm -f "$tmp".*' EXIT
+
+seq 40 >"$tmp".tiny
+
+input=$tmp.tiny
+iterations=1000
+arguments='-w 80'
+environment='LC_ALL=C'
+run_bench startup in the C locale
+
+input=$tmp.tiny
+iterations=1000
+arguments='-w 80'
+environment='LC_ALL=C.UTF-8'
+run_bench startup in a UTF-8 locale
+
+awk 'BEGIN {
+	for (i = 0; i < 20000; i++)
+		printf "%d,\"%d, %d\",\"say \"\"%d\"\"\"\n", i, i%7, i%13, i%31
+}' >"$tmp".csv
+
+input=$tmp.csv
+iterations=20
+arguments='-q'
+environment='LC_ALL=C.UTF-8'
+run_bench columnating CSV
+
+awk 'BEGIN {
+	for (i = 0; i < 200000; i++)
+		printf "item%d%s", i*7919%100003, (i%8 == 7 ? "\n" : " ")
+}' >"$tmp".words
+
+tr ' ' '\n' <"$tmp".words >"$tmp".lines
+tr ' \n' '\t\n' <"$tmp".words >"$tmp".tsv
+awk '{ printf "%s::", $0 }' <"$tmp".lines >"$tmp".string
+awk '{ printf "\033[1m%s\033[0m\n", $0 }' <"$tmp".lines >"$tmp".colored
+awk '{ printf "%d,%d:%s\n", length($0), length($0), $0 }' <"$tmp".lines \
+	>"$tmp".records
+awk 'BEGIN {
+	e[0] = "\360\237\221\215\360\237\217\275"
+	e[1] = "\360\237\221\250\342\200\215\360\237\221\251\342\200\215\360\237\221\247"
+	e[2] = "\360\237\207\271\360\237\207\267"
+	e[3] = "e\314\201"
+}
+{ printf "%s%s\n", $0, e[NR%4] }' <"$tmp".lines >"$tmp".clusters
+
+input=$tmp.lines
+iterations=20
+arguments='-I'
+environment='LC_ALL=C.UTF-8'
+run_bench parsing lines
+
+input=$tmp.records
+iterations=20
+arguments='-I -M'
+environment='LC_ALL=C.UTF-8'
+run_bench loading measured records
+
+input=$tmp.string
+iterations=20
+arguments='-I -d ::'
+environment='LC_ALL=C.UTF-8'
+run_bench parsing with a string delimiter
+
+input=$tmp.words
+iterations=20
+arguments='-I -s'
+environment='LC_ALL=C.UTF-8'
+run_bench parsing words
+
+input=$tmp.words
+iterations=20
+arguments='-I -S'
+environment='LC_ALL=C.UTF-8'
+run_bench parsing sentences
+
+input=$tmp.colored
+iterations=20
+arguments='-I -R'
+environment='LC_ALL=C.UTF-8'
+run_bench parsing colored lines
+
+input=$tmp.tsv
+iterations=20
+arguments='-I -t'
+environment='LC_ALL=C.UTF-8'
+run_bench parsing a table
+
+awk 'BEGIN {
+	for (i = 0; i < 200000; i++)
+		printf "%s\t%d\thost%d\n", i%3 ? "GET" : "POST", 200 + i%4, i%20
+}' >"$tmp".repetitive
+
+input=$tmp.repetitive
+iterations=20
+arguments='-I -t'
+environment='LC_ALL=C.UTF-8'
+run_bench parsing a repetitive table
+
+input=$tmp.repetitive
+iterations=20
+arguments='-I -t -U'
+environment='LC_ALL=C.UTF-8'
+run_bench parsing a repetitive table with interning
+
+input=$tmp.clusters
+iterations=20
+arguments='-I'
+environment='LC_ALL=C.UTF-8'
+run_bench parsing grapheme clusters
+
+awk 'BEGIN {
+	for (i = 0; i < 100000; i++)
+		printf "%.*s\n", 1 + i*7919%24, "abcdefghijklmnopqrstuvwxyz"
+}' >"$tmp".ragged
+
+input=$tmp.ragged
+iterations=20
+arguments='-w 160'
+environment='LC_ALL=C.UTF-8'
+run_bench padding with spaces
+measure_size padding with spaces
+
+input=$tmp.ragged
+iterations=20
+arguments='-w 160 -e'
+environment='LC_ALL=C.UTF-8'
+run_bench padding with tabs
+measure_size padding with tabs
+
+awk 'BEGIN {
+	srand(1)
+	for (i = 0; i < 1000000; i++)
+		printf "%.*s\n", 1 + rand()*rand()*20, "abcdefghijklmnopqrstuvwxyz"
+}' >"$tmp".long
+
+input=$tmp.long
+iterations=5
+arguments='-w 2000 -l 1:1'
+environment='LC_ALL=C'
+run_bench laying out a long list
+
+input=$tmp.long
+iterations=5
+arguments='-w 2000 -l 1:1 -A'
+environment='LC_ALL=C'
+run_bench laying out a long list approximately
+
+# vim: fdm=marker
@@ -61,6 +61,9 @@ program=./nat
 export LC_ALL=C
 unset COLUMNS
 
+file=${TMPDIR:-/tmp}/nat_test.$$
+trap 'rm -rf "$file" "$file.d"' EXIT
+
 input=
 arguments='-c -1'
 environment=
@@ -68,6 +71,13 @@ expected_output=
 expected_status=2
 run_test an invalid argument 2>/dev/null
 
+input=
+arguments='-c 0 2>&1'
+environment='LC_ALL=C.UTF-8'
+expected_output='-c: Invalid argument\n'
+expected_status=2
+run_test the message for an invalid argument
+
 input='x\n'
 arguments='-w -78'
 environment=
@@ -117,6 +127,13 @@ expected_output='x\nx\n'
 expected_status=0
 run_test NUL as delimiter
 
+input='x<>y<z<>'
+arguments='-d "<>" -w 3'
+environment=
+expected_output='x  \ny<z\n'
+expected_status=0
+run_test a multi-character delimiter
+
 input='x\n'
 arguments=
 environment='COLUMNS=2'
@@ -166,6 +183,41 @@ expected_output='x\n'
 expected_status=1
 run_test not enough room
 
+input='x\nxx\n'
+arguments='-w 4,7'
+environment=
+expected_output='7:\nx  xx  \n\n4:\nx   \nxx  \n'
+expected_status=0
+run_test multiple widths
+
+input='xx\nx\n'
+arguments='-w 1,2 -I'
+environment=
+expected_output='2:\n2 2 2 1 0 0 2\n\n1:\n2 1 2 1 0 0 1\n'
+expected_status=1
+run_test truncation with multiple widths
+
+input='100\n20\n'
+arguments='-o n -w 7,2'
+environment=
+expected_output='7:\n20  100\n\n2:\n10\n20\n'
+expected_status=1
+run_test -o with multiple widths
+
+input='\344\270\255\344\270\255\nx\n'
+arguments='-p 0 -w 4,3'
+environment='LC_ALL=C.UTF-8'
+expected_output='4:\n\344\270\255\344\270\255\nx   \n\n3:\n\344\270\255x\n'
+expected_status=1
+run_test a narrower layout after truncation
+
+input='abcd1\nabcd2\nz\n'
+arguments='-u -w 20,3'
+environment=
+expected_output=
+expected_status=2
+run_test -u with multiple widths 2>/dev/null
+
 input='x\nxx\n'
 arguments='-w 4'
 environment=
@@ -180,6 +232,48 @@ expected_output='\0x  x\n'
 expected_status=0
 run_test an item containing NULs
 
+input='3,1:x\0y2:zz\n1:w\n'
+arguments='-M -w 8'
+environment=
+expected_output='x\0y  zz  w\n'
+expected_status=0
+run_test -M
+
+input='3:xy'
+arguments='-M'
+environment=
+expected_output=
+expected_status=2
+run_test a truncated record with -M 2>/dev/null
+
+input='x\351\ny\n'
+arguments='-w 6'
+environment=
+expected_output='x\351  y  \n'
+expected_status=0
+run_test a byte not valid in the C locale
+
+input='\360\237\221\215\360\237\217\275\n\360\237\221\250\342\200\215\360\237\221\251\342\200\215\360\237\221\247\n\360\237\207\271\360\237\207\267\ne\314\201\n'
+arguments='-w 6'
+environment='LC_ALL=C.UTF-8'
+expected_output='\360\237\221\215\360\237\217\275  \360\237\207\271\360\237\207\267\n\360\237\221\250\342\200\215\360\237\221\251\342\200\215\360\237\221\247  e\314\201 \n'
+expected_status=0
+run_test grapheme clusters
+
+input='x\314\201\314\201y\n'
+arguments='-d "$(printf "\314\201")" -c 1'
+environment='LC_ALL=C.UTF-8'
+expected_output='x\n \ny\n'
+expected_status=0
+run_test a combining mark as the delimiter
+
+input='x\342\200\250\342\200\250y\n'
+arguments='-s -c 1'
+environment='LC_ALL=C.UTF-8'
+expected_output='x\ny\n'
+expected_status=0
+run_test line separators with -s
+
 input='xx\nx\nx\nx\nx\nx\nxx\nx\nxx\n'
 arguments='-w 9'
 environment=
@@ -201,6 +295,27 @@ expected_output='x  y\nx   \n'
 expected_status=0
 run_test -a
 
+input='1\n2\n3\n4\n'
+arguments='-x -w 7'
+environment=
+expected_output='1  2  3\n4      \n'
+expected_status=0
+run_test -x
+
+input='aaa\nb\ncc\ndddd\ne\n'
+arguments='-A -w 10'
+environment=
+expected_output='aaa  dddd \nb    e    \ncc        \n'
+expected_status=0
+run_test -A
+
+input='aaa\nb\ncc\ndddd\ne\n'
+arguments='-A -I -w 10'
+environment=
+expected_output='5 10 3 2 1 0 3 4\n'
+expected_status=0
+run_test -A with -I
+
 input='x\nxx\n'
 arguments='-c 1'
 environment=
@@ -236,6 +351,55 @@ expected_output=$input
 expected_status=0
 run_test -c overriding -w
 
+input='b\nB\na\n'
+arguments='-o b -w 7'
+environment=
+expected_output='B  a  b\n'
+expected_status=0
+run_test -o b
+
+input='b\na\n'
+arguments='-o c -w 4'
+environment=
+expected_output='a  b\n'
+expected_status=0
+run_test -o c
+
+input='10\n9\nx\n'
+arguments='-o n -w 8'
+environment=
+expected_output='x  9  10\n'
+expected_status=0
+run_test -o n
+
+input='1\nnan\n-1\n0\n'
+arguments='-o n -w 13'
+environment=
+expected_output='-1  0  nan  1\n'
+expected_status=0
+run_test NaN with -o n
+
+input='x\ny\nx\ny\n'
+arguments='-u -w 4'
+environment=
+expected_output='x  y\n'
+expected_status=0
+run_test -u
+
+input='y\nx\ny\n'
+arguments='-u -o b -w 4'
+environment=
+expected_output='x  y\n'
+expected_status=0
+run_test -u with -o
+
+input=
+arguments='-t -o b'
+environment=
+expected_output=
+expected_status=2
+run_test -t with -o 2>/dev/null
+
 input='x\tx\nxx\tx\n'
 arguments='-t'
 environment=
@@ -278,6 +442,34 @@ expected_output='x  x\tx\n'
 expected_status=0
 run_test -t with -c
 
+input='x\ty\tzz\nxx\n'
+arguments='-t -f 3,1'
+environment=
+expected_output='zz  x \n    xx\n'
+expected_status=0
+run_test -t with -f
+
+input='x,"y, ""z"""\r\n"a\nb",c\r\n'
+arguments='-q'
+environment=
+expected_output='x    y, "z"\na b  c     \n'
+expected_status=0
+run_test -q
+
+input='a"b,c\nd,e"",f\n'
+arguments='-q'
+environment=
+expected_output='a"b  c     \nd    e""  f\n'
+expected_status=0
+run_test -q with quotes inside fields
+
+input='GET\t200\nPOST\t404\nGET\t200\n'
+arguments='-t -U'
+environment=
+expected_output='GET   200\nPOST  404\nGET   200\n'
+expected_status=0
+run_test -t with -U
+
 input='x x\tx\nx\n'
 arguments='-s -w 10'
 environment=
@@ -320,6 +512,168 @@ expected_output='\n'
 expected_status=0
 run_test 'corner case #2'
 
+input='x\nyy\n\nz\n\n\n'
+arguments='-b -w 6'
+environment=
+expected_output='x  yy \n\nz     \n'
+expected_status=0
+run_test -b
+
+input='x\ty\n\nxx\n'
+arguments='-t -b'
+environment=
+expected_output='x  y\n\nxx\n'
+expected_status=0
+run_test -t with -b
+
+input='x\nx\n\nx\n\nx\nx\n'
+arguments='-g -a -w 4'
+environment=
+expected_output='1 1\nx  x\n2 2\nx   \n2 3\nx  x\nx   \n'
+expected_status=0
+run_test -g
+
+input='x\nx\nxx\nx\nx\n'
+arguments='-P 2 -w 5'
+environment=
+expected_output='x  x \nxx  x\nx    \n'
+expected_status=0
+run_test -P
+
+input='x  y\tz'
+arguments='-S -P 1 -w 4'
+environment=
+expected_output='x   \ny   \nz   \n'
+expected_status=0
+run_test -S with -P
+
+input='x\nyy\nz\nxx\n'
+arguments='-i -w 6'
+environment=
+expected_output='x   z \nyy  xx\n'
+expected_status=0
+run_test -i
+
+input='a b  c\n'
+arguments='-i -s -w 9'
+environment=
+expected_output='a  b  c  \n'
+expected_status=0
+run_test -i with -s
+
+input='a,"b,c",d\ne,f,g\n'
+arguments='-i -q -d ,'
+environment=
+expected_output='a  b,c  d\ne  f    g\n'
+expected_status=0
+run_test -i with -q
+
+program='seq 30000 | ./nat'
+input=
+arguments='-i -c 3 -I'
+environment=
+expected_output='30000 19 10000 3 0 0 5 5 5\n'
+expected_status=0
+run_test -i with input longer than a buffer
+
+program='yes "$(printf "\303\251")" | head -n 40000 | LC_ALL=C.UTF-8 ./nat'
+input=
+arguments='-i -c 2 -I'
+environment=
+expected_output='40000 4 20000 2 0 0 1 1\n'
+expected_status=0
+run_test -i with characters split between buffers
+program=./nat
+
+input='x\n'
+arguments='-i -b'
+environment=
+expected_output=
+expected_status=2
+run_test -i with -b 2>/dev/null
+
+printf 'x\nyy\nz\nxx\n' >"$file"
+
+input=
+arguments='-m -w 6 <"$file"'
+environment=
+expected_output='x   z \nyy  xx\n'
+expected_status=0
+run_test -m
+
+printf 'xyx' >"$file"
+
+input=
+arguments='-m -d y -w 1 -a <"$file"'
+environment=
+expected_output='x\nx\n'
+expected_status=0
+run_test -m with -d
+
+printf 'x,y,\n' >"$file"
+
+input=
+arguments='-m -d , -c 1 <"$file"'
+environment=
+expected_output='x\ny\n \n'
+expected_status=0
+run_test an empty last item with -m
+
+input='x,y,\n'
+arguments='-d , -c 1'
+environment=
+expected_output='x\ny\n \n'
+expected_status=0
+run_test an empty last item without -m
+
+input='x\nyy\nz\n'
+arguments='-j -w 7 -r 2'
+environment=
+expected_output='{"items":3,"width":7,"rows":2,"columns":2,"surplus":2,"bytes":16,"widths":[2,1],"right":[false,true]}
+{"row":0,"column":0,"offset":0,"width":1}
+{"row":1,"column":0,"offset":8,"width":2}
+{"row":0,"column":1,"offset":4,"width":1}
+'
+expected_status=0
+run_test -j
+
+input='x\nxx\ny\nyy\nz\n'
+arguments='-c 2 -l 2:1'
+environment=
+expected_output='xx  z \n'
+expected_status=0
+run_test -l
+
+input='x\ty\nxx\ny\ty\n'
+arguments='-t -l 2'
+environment=
+expected_output='xx   \ny   y\n'
+expected_status=0
+run_test -t with -l
+
+mkdir "$file.d"
+
+input='xx\ny\n'
+arguments='-k "$file.d" -w 1'
+environment=
+expected_output='x\ny\n'
+expected_status=1
+run_test -k with a new entry
+
+input='xx\ny\n'
+arguments='-k "$file.d" -w 1'
+environment=
+expected_output='x\ny\n'
+expected_status=1
+run_test -k with an existing entry
+
+input='xxx\ny\n'
+arguments='-k "$file.d/none" -w 1'
+environment=
+expected_output='x\ny\n'
+expected_status=1
+run_test -k with a cache that cannot be written
+
 input='x\nxx\n'
 arguments='-w 2 -r 1'
 environment=
@@ -327,6 +681,20 @@ expected_output=' x\nxx\n'
 expected_status=0
 run_test -r
 
+input='xxxxxx\nx\nx\n'
+arguments='-e -w 16'
+environment=
+expected_output='xxxxxx\tx  x\t\n'
+expected_status=0
+run_test -e
+
+input='xxxxxx\nx\nx\n'
+arguments='-e -w 12'
+environment='TABSIZE=5'
+expected_output='xxxxxx  x  x\n'
+expected_status=0
+run_test -e with TABSIZE
+
 input='x\nxx\nx\nxx\n'
 arguments='-w 6 -r -1'
 environment=
@@ -369,6 +737,20 @@ expected_output='\33[mx   \n'
 expected_status=0
 run_test -R
 
+input='\33[mxx\33[m\nx\n'
+arguments='-R -w 1'
+environment=
+expected_output='\33[mx\nx\n'
+expected_status=1
+run_test truncation with -R
+
+input='\33[1;31mx\33[m;y\n'
+arguments='-R -d ";" -w 4'
+environment=
+expected_output='\33[1;31mx\33[m  y\n'
+expected_status=0
+run_test a delimiter inside color sequences with -R
+
 input='x x  x'
 arguments='-S -w 3'
 environment=
@@ -383,4 +765,47 @@ expected_output='x\n'
 expected_status=0
 run_test trailing space with -S
 
+LC_ALL=C.UTF-8 ./nat -D ./nat.sock &
+server=$!
+trap 'kill $server; rm -rf ./nat.sock "$file" "$file.d"' EXIT
+
+while ! test -S ./nat.sock; do
+	sleep 1
+done
+
+input='x\nxx\n'
+arguments='-w 4 -r 1'
+environment='NAT_SOCKET=./nat.sock'
+expected_output=' x  \nxx  \n'
+expected_status=0
+run_test -D
+
+input='xx\n'
+arguments='-w 1'
+environment='NAT_SOCKET=./nat.sock'
+expected_output='x\n'
+expected_status=1
+run_test exit status with -D
+
+input='x\351\ny\n'
+arguments='-w 6'
+environment='NAT_SOCKET=./nat.sock LC_ALL=C'
+expected_output='x\351  y  \n'
+expected_status=0
+run_test the locale of the client with -D
+
+input='xxxxxx\nx\nx\n'
+arguments='-e -w 12'
+environment='NAT_SOCKET=./nat.sock TABSIZE=5'
+expected_output='xxxxxx  x  x\n'
+expected_status=0
+run_test TABSIZE with -D
+
+input='x\n'
+arguments='-k "$file.d"'
+environment='NAT_SOCKET=./nat.sock'
+expected_output=
+expected_status=2
+run_test -k with -D 2>/dev/null
+
 # vim: fdm=marker